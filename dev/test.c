@@ -78,6 +78,1870 @@ test(
 }
 
 
+#ifdef DEV_ALLOC
+	#include <errno.h>
+	#include <stdlib.h>
+
+	#include "../include/alloc_ext.h"
+	#include "../include/alloc_fast.h"
+
+	#ifdef __linux__
+		#include <sys/mman.h>
+		#include <sys/wait.h>
+		#include <unistd.h>
+	#endif
+
+
+/* Blocks whose inline header would waste a page keep it in the page before
+ * them, so that 2 objects aligned to their size fit a block twice as big.
+ */
+void
+test_headers(
+	void
+	)
+{
+	AllocHandleInfo Info =
+	{
+		.AllocSize = 1 << 22,
+		.BlockSize = 1 << 23,
+		.Alignment = 1 << 22
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+
+	uint8_t* Ptrs[2];
+
+	for(size_t i = 0; i < 2; ++i)
+	{
+		Ptrs[i] = AllocAllocH(&Handle, Info.AllocSize, 1);
+		AssertNEQ(Ptrs[i], NULL);
+		AssertEQ(((uintptr_t) Ptrs[i] & (Info.Alignment - 1)), 0);
+
+		(void) memset(Ptrs[i], 0xFF, Info.AllocSize);
+	}
+
+	AssertEQ(((uintptr_t) Ptrs[0] & ~(Info.BlockSize - 1)),
+		((uintptr_t) Ptrs[1] & ~(Info.BlockSize - 1)));
+
+	for(size_t i = 0; i < 2; ++i)
+	{
+		AllocFreeH(&Handle, Ptrs[i], Info.AllocSize);
+	}
+
+	AssertEQ(AllocHandleTrimH(&Handle, 0), Info.BlockSize);
+
+	AllocDestroyHandle(&Handle);
+}
+
+
+/* The first objects of colored blocks start at different cache lines, and
+ * all of them stay within their block.
+ */
+void
+test_colors(
+	void
+	)
+{
+	AllocHandleInfo Info =
+	{
+		.AllocSize = 1024,
+		.BlockSize = 1 << 16,
+		.Alignment = 64,
+		.CacheColors = 8
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+
+	/* About 32 blocks.
+	 */
+	static uint8_t* Ptrs[2048];
+	uintptr_t Bases[64];
+	uintptr_t Offsets[64];
+	size_t BaseCount = 0;
+
+	for(size_t Count = 0; Count < 2048; ++Count)
+	{
+		Ptrs[Count] = AllocAllocH(&Handle, Info.AllocSize, 0);
+		AssertNEQ(Ptrs[Count], NULL);
+		AssertEQ(((uintptr_t) Ptrs[Count] & (Info.Alignment - 1)), 0);
+
+		uintptr_t Base = (uintptr_t) Ptrs[Count] & ~(Info.BlockSize - 1);
+		uintptr_t Offset = (uintptr_t) Ptrs[Count] - Base;
+		AssertLE(Offset + Info.AllocSize, Info.BlockSize);
+
+		size_t i = 0;
+
+		while(i < BaseCount && Bases[i] != Base)
+		{
+			++i;
+		}
+
+		if(i == BaseCount)
+		{
+			AssertLT(BaseCount, 64);
+
+			Bases[i] = Base;
+			Offsets[i] = Offset;
+			++BaseCount;
+		}
+		else if(Offset < Offsets[i])
+		{
+			Offsets[i] = Offset;
+		}
+	}
+
+	size_t Colors = 0;
+
+	for(size_t i = 0; i < BaseCount; ++i)
+	{
+		AssertLE(Offsets[i], Info.Alignment * Info.CacheColors);
+
+		size_t j = 0;
+
+		while(j < i && Offsets[j] != Offsets[i])
+		{
+			++j;
+		}
+
+		Colors += j == i;
+	}
+
+	AssertGT(Colors, 1);
+
+	for(size_t i = 0; i < 2048; ++i)
+	{
+		AllocFreeH(&Handle, Ptrs[i], Info.AllocSize);
+	}
+
+	AllocDestroyHandle(&Handle);
+}
+
+
+/* Fine-grained classes are aligned at least as well as `malloc` would align
+ * objects of their size.
+ */
+void
+test_fine(
+	void
+	)
+{
+	const AllocState* State = AllocAllocState(AllocGetFineStateInfo());
+	AssertNEQ(State, NULL);
+
+	AssertEQ(AllocGetHandleS(State, 10), AllocGetHandleS(State, 16));
+	AssertEQ(AllocGetHandleS(State, 20), AllocGetHandleS(State, 32));
+	AssertEQ(AllocGetHandleS(State, 40), AllocGetHandleS(State, 48));
+	AssertEQ(AllocGetHandleS(State, 56), AllocGetHandleS(State, 64));
+	AssertNEQ(AllocGetHandleS(State, 65), AllocGetHandleS(State, 64));
+	AssertEQ(AllocGetHandleS(State, 65), AllocGetHandleS(State, 80));
+
+	for(size_t Size = 1; Size <= 1024; ++Size)
+	{
+		size_t Alignment = _Alignof(max_align_t);
+
+		while(Alignment > Size)
+		{
+			Alignment >>= 1;
+		}
+
+		void* Ptr = AllocAllocS(State, Size, 0);
+		AssertNEQ(Ptr, NULL);
+		AssertEQ((uintptr_t) Ptr % Alignment, 0);
+
+		AllocFreeS(State, Size, Ptr);
+	}
+
+	AllocFreeState(State);
+}
+
+
+/* Blocks start small and double in size. Only the ones in use hold any
+ * address space.
+ */
+void
+test_nursery(
+	void
+	)
+{
+	AllocHandleInfo Info =
+	{
+		.AllocSize = 64,
+		.BlockSize = 1 << 20,
+		.Alignment = 64,
+		.InitialBlockSize = 1 << 16
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+
+	size_t PageSize = AllocGetPageSize();
+	size_t FirstSize = PageSize > Info.InitialBlockSize ?
+		PageSize : Info.InitialBlockSize;
+
+	uint8_t* Ptr = AllocAllocH(&Handle, Info.AllocSize, 1);
+	AssertNEQ(Ptr, NULL);
+
+#ifdef __linux__
+	unsigned char Resident;
+	uint8_t* Rest = (uint8_t*) ((uintptr_t) Ptr & ~(FirstSize - 1)) + FirstSize;
+
+	AssertEQ(mincore(Rest, PageSize, &Resident), -1);
+	AssertEQ(errno, ENOMEM);
+#endif
+
+	AllocFreeH(&Handle, Ptr, Info.AllocSize);
+	AssertEQ(AllocHandleTrimH(&Handle, 0), FirstSize);
+
+	/* Past the nursery into 2 full blocks.
+	 */
+	size_t Count = (Info.BlockSize * 3) / Info.AllocSize;
+	uint8_t** Ptrs = malloc(Count * sizeof(*Ptrs));
+	AssertNEQ(Ptrs, NULL);
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		Ptrs[i] = AllocAllocH(&Handle, Info.AllocSize, 0);
+		AssertNEQ(Ptrs[i], NULL);
+
+		(void) memset(Ptrs[i], (uint8_t) i, Info.AllocSize);
+	}
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		AssertEQ(Ptrs[i][Info.AllocSize - 1], (uint8_t) i);
+	}
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		AllocFreeH(&Handle, Ptrs[Count - 1 - i], Info.AllocSize);
+	}
+
+	free(Ptrs);
+
+	AllocDestroyHandle(&Handle);
+}
+
+
+/* Zeroing allocations leave memory that is known to be zero alone, be it
+ * a fresh object or one whose pages were given back when it was freed.
+ */
+void
+test_zero(
+	void
+	)
+{
+	AllocHandleInfo Info =
+	{
+		.AllocSize = 1 << 22,
+		.BlockSize = 1 << 24,
+		.Alignment = 64
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+	AllocHandleAddFlagsH(&Handle, ALLOC_HANDLE_FLAG_PURGE_ON_FREE);
+
+	size_t PageSize = AllocGetPageSize();
+
+	uint8_t* Ptr = AllocAllocH(&Handle, Info.AllocSize, 1);
+	AssertNEQ(Ptr, NULL);
+
+#ifdef __linux__
+	/* Skips the page shared with the block header.
+	 */
+	uint8_t* Pages = (uint8_t*) (((uintptr_t) Ptr + PageSize) &
+		~(PageSize - 1));
+	size_t PageCount = (Info.AllocSize - PageSize) / PageSize;
+
+	static unsigned char Resident[1 << 10];
+
+	AssertEQ(mincore(Pages, PageCount * PageSize, Resident), 0);
+
+	for(size_t i = 0; i < PageCount; ++i)
+	{
+		AssertEQ((Resident[i] & 1), 0);
+	}
+#endif
+
+	(void) memset(Ptr, 0xFF, Info.AllocSize);
+	AllocFreeH(&Handle, Ptr, Info.AllocSize);
+
+	uint8_t* Again = AllocAllocH(&Handle, Info.AllocSize, 1);
+	AssertEQ(Again, Ptr);
+
+#ifdef __linux__
+	AssertEQ(mincore(Pages, PageCount * PageSize, Resident), 0);
+
+	for(size_t i = 0; i < PageCount; ++i)
+	{
+		AssertEQ((Resident[i] & 1), 0);
+	}
+#endif
+
+	for(size_t i = 0; i < Info.AllocSize; ++i)
+	{
+		AssertEQ(Ptr[i], 0);
+	}
+
+	AllocFreeH(&Handle, Ptr, Info.AllocSize);
+
+	AllocDestroyHandle(&Handle);
+}
+
+
+/* Blocks of 2 byte objects are 128KiB, unless a page is bigger.
+ */
+void
+test_block_size(
+	void
+	)
+{
+	AllocHandleInfo Info =
+	{
+		.AllocSize = 2,
+		.BlockSize = 1 << 20,
+		.Alignment = 2
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+
+	size_t PageSize = AllocGetPageSize();
+	size_t BlockSize = PageSize > 131072 ? PageSize : 131072;
+
+	/* Blocks are aligned to their size, so the first block ends where an
+	 * object of another one shows up.
+	 */
+	size_t Count = BlockSize / Info.AllocSize;
+	uint8_t** Ptrs = malloc(Count * sizeof(*Ptrs));
+	AssertNEQ(Ptrs, NULL);
+
+	uintptr_t Mask = ~(uintptr_t) (BlockSize - 1);
+	size_t Used = 0;
+
+	do
+	{
+		AssertLE(Used, Count - 1);
+
+		Ptrs[Used] = AllocAllocH(&Handle, Info.AllocSize, 0);
+		AssertNEQ(Ptrs[Used], NULL);
+	}
+	while(((uintptr_t) Ptrs[Used++] & Mask) == ((uintptr_t) Ptrs[0] & Mask));
+
+	/* The next block starts with its header, not with an object.
+	 */
+	uint8_t* End = Ptrs[Used - 2] + Info.AllocSize;
+	AssertNEQ(Ptrs[Used - 1], End);
+
+	size_t Size = (Used - 1) * Info.AllocSize;
+	AssertGE(Size, BlockSize / 2);
+
+	for(size_t i = 0; i < Used; ++i)
+	{
+		AllocFreeH(&Handle, Ptrs[i], Info.AllocSize);
+	}
+
+	free(Ptrs);
+
+	AllocDestroyHandle(&Handle);
+}
+
+
+static uint32_t
+test_small_index_func(
+	alloc_t Size
+	)
+{
+	return Size > 100 ? 5 : Size > 24 ? 2 : 0;
+}
+
+
+/* The table of small sizes picks the same handles as the index function, and
+ * steps that the function splits are left to it.
+ */
+void
+test_small_index(
+	void
+	)
+{
+	AllocStateInfo Info = *AllocGetFineStateInfo();
+	Info.IndexFunc = test_small_index_func;
+
+	const AllocState* States[3] =
+	{
+		AllocGetGlobalState(),
+		AllocAllocState(AllocGetFineStateInfo()),
+		AllocAllocState(&Info)
+	};
+
+	for(size_t i = 0; i < 3; ++i)
+	{
+		const AllocState* State = States[i];
+		AssertNEQ(State, NULL);
+
+		for(alloc_t Size = 1; Size <= ALLOC_SMALL_INDEX_MAX + 64; ++Size)
+		{
+			uint32_t Index = 0;
+
+			if(State->IndexFunc)
+			{
+				Index = State->IndexFunc(Size);
+			}
+			else
+			{
+				while(((alloc_t) 1 << Index) < Size)
+				{
+					++Index;
+				}
+			}
+
+			if(Index > State->HandleCount - 1)
+			{
+				Index = State->HandleCount - 1;
+			}
+
+			AssertEQ(AllocGetHandleS(State, Size), &State->Handles[Index]);
+			AssertEQ(AllocGetHandleFastS(State, Size), &State->Handles[Index]);
+		}
+	}
+
+	/* 97 to 104 bytes straddle a class boundary, everything else above 8
+	 * bytes does not.
+	 */
+	for(size_t i = 0; i < sizeof(States[2]->SmallIndex); ++i)
+	{
+		int None = States[2]->SmallIndex[i] == ALLOC_SMALL_INDEX_NONE;
+		int Split = i == (100 >> ALLOC_SMALL_INDEX_SHIFT);
+
+		AssertEQ(None, Split);
+	}
+
+	for(size_t i = 1; i < sizeof(States[0]->SmallIndex); ++i)
+	{
+		AssertNEQ(States[0]->SmallIndex[i], ALLOC_SMALL_INDEX_NONE);
+	}
+
+	AllocFreeState(States[1]);
+	AllocFreeState(States[2]);
+}
+
+
+/* The inlined fast paths hand out the same objects as `AllocAllocUH`, and
+ * their objects can be freed as usual.
+ */
+void
+test_fast_paths(
+	void
+	)
+{
+	alloc_t Sizes[3] = { 1, 2, 64 };
+	size_t Count = 100000;
+
+	uint8_t** Ptrs = malloc(Count * sizeof(*Ptrs));
+	AssertNEQ(Ptrs, NULL);
+
+	for(size_t i = 0; i < 3; ++i)
+	{
+		AllocHandleInfo Info =
+		{
+			.AllocSize = Sizes[i],
+			.BlockSize = 1 << 16,
+			.Alignment = Sizes[i]
+		};
+
+		AllocHandle Handle = {0};
+		AllocCreateHandle(&Info, &Handle);
+
+		/* Every other object is freed right away, so that both the free
+		 * lists and the unused tails of blocks are used.
+		 */
+		for(size_t j = 0; j < Count; ++j)
+		{
+			Ptrs[j] = AllocAllocFastUH(&Handle, Info.AllocSize, 0);
+			AssertNEQ(Ptrs[j], NULL);
+
+			(void) memset(Ptrs[j], (uint8_t) j, Info.AllocSize);
+
+			if(j % 2)
+			{
+				AllocFreeUH(&Handle, Ptrs[j - 1], Info.AllocSize);
+				Ptrs[j - 1] = NULL;
+			}
+		}
+
+		for(size_t j = 1; j < Count; j += 2)
+		{
+			AssertEQ(Ptrs[j][0], (uint8_t) j);
+			AssertEQ(Ptrs[j][Info.AllocSize - 1], (uint8_t) j);
+		}
+
+		/* Both ends pop the same free list.
+		 */
+		void* Ptr = AllocAllocUH(&Handle, Info.AllocSize, 0);
+		AllocFreeUH(&Handle, Ptr, Info.AllocSize);
+		AssertEQ(AllocAllocFastUH(&Handle, Info.AllocSize, 0), Ptr);
+
+		Ptr = AllocAllocFastUH(&Handle, Info.AllocSize, 0);
+		AllocFreeUH(&Handle, Ptr, Info.AllocSize);
+		AssertEQ(AllocAllocUH(&Handle, Info.AllocSize, 0), Ptr);
+
+		AllocDestroyHandle(&Handle);
+	}
+
+	free(Ptrs);
+
+	const AllocState* State = AllocAllocState(NULL);
+	AssertNEQ(State, NULL);
+
+	for(alloc_t Size = 1; Size <= 256; ++Size)
+	{
+		uint8_t* Ptr = AllocAllocFastUS(State, Size, 0);
+		AssertNEQ(Ptr, NULL);
+
+		(void) memset(Ptr, 0xFF, Size);
+
+		AllocFreeS(State, Size, Ptr);
+	}
+
+	AllocFreeState(State);
+}
+
+
+static int
+test_compare_ptrs(
+	const void* A,
+	const void* B
+	)
+{
+	uintptr_t PtrA = (uintptr_t) *(void* const*) A;
+	uintptr_t PtrB = (uintptr_t) *(void* const*) B;
+
+	return (PtrA > PtrB) - (PtrA < PtrB);
+}
+
+
+/* Objects of sizes that are not powers of 2 are indexed with a multiplication
+ * by an inverse instead of a division. Freeing them out of order and taking
+ * them again must never hand out the same object twice.
+ */
+void
+test_inverse_divide(
+	void
+	)
+{
+	alloc_t Sizes[] = { 5, 6, 12, 24, 40, 48, 80, 100, 1000, 4095 };
+	size_t Count = 3000;
+
+	void** Ptrs = malloc(Count * sizeof(*Ptrs));
+	AssertNEQ(Ptrs, NULL);
+
+	for(size_t i = 0; i < sizeof(Sizes) / sizeof(Sizes[0]); ++i)
+	{
+		AllocHandleInfo Info =
+		{
+			.AllocSize = Sizes[i],
+			.BlockSize = 1 << 16,
+			.Alignment = Sizes[i] & -Sizes[i]
+		};
+
+		AllocHandle Handle = {0};
+		AllocCreateHandle(&Info, &Handle);
+
+		for(size_t j = 0; j < Count; ++j)
+		{
+			Ptrs[j] = AllocAllocH(&Handle, Info.AllocSize, 0);
+			AssertNEQ(Ptrs[j], NULL);
+		}
+
+		/* 7919 is prime, so this visits every object once.
+		 */
+		for(size_t j = 0; j < Count; ++j)
+		{
+			AllocFreeH(&Handle, Ptrs[j * 7919 % Count], Info.AllocSize);
+		}
+
+		for(size_t j = 0; j < Count; ++j)
+		{
+			Ptrs[j] = AllocAllocH(&Handle, Info.AllocSize, 0);
+			AssertNEQ(Ptrs[j], NULL);
+		}
+
+		qsort(Ptrs, Count, sizeof(*Ptrs), test_compare_ptrs);
+
+		for(size_t j = 1; j < Count; ++j)
+		{
+			uint8_t* End = (uint8_t*) Ptrs[j - 1] + Info.AllocSize;
+
+			AssertGE((uint8_t*) Ptrs[j], End);
+		}
+
+		AllocDestroyHandle(&Handle);
+	}
+
+	free(Ptrs);
+}
+
+
+/* Tiny objects of bitmap handles are handed out in address order, freed ones
+ * are never written to, and the lowest free one is always reused first.
+ */
+void
+test_bitmap(
+	void
+	)
+{
+	AllocHandleInfo Info =
+	{
+		.AllocSize = 8,
+		.BlockSize = 1 << 16,
+		.Alignment = 8,
+		.Type = ALLOC_HANDLE_TYPE_BITMAP
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+
+	uint8_t* Ptrs[1024];
+	size_t Count = sizeof(Ptrs) / sizeof(Ptrs[0]);
+
+	/* Any size up to `AllocSize` goes.
+	 */
+	for(size_t i = 0; i < Count; ++i)
+	{
+		alloc_t Size = i % Info.AllocSize + 1;
+
+		Ptrs[i] = AllocAllocH(&Handle, Size, 0);
+		AssertNEQ(Ptrs[i], NULL);
+
+		(void) memset(Ptrs[i], 0xAB, Size);
+
+		if(i)
+		{
+			AssertEQ(Ptrs[i], Ptrs[i - 1] + Info.AllocSize);
+		}
+	}
+
+	for(size_t i = Count; i > 1; i -= 2)
+	{
+		AllocFreeH(&Handle, Ptrs[i - 1], Info.AllocSize);
+	}
+
+	for(size_t i = 1; i < Count; i += 2)
+	{
+		AssertEQ(Ptrs[i][0], 0xAB);
+	}
+
+	for(size_t i = 1; i < Count; i += 2)
+	{
+		AssertEQ(AllocAllocH(&Handle, Info.AllocSize, 0), Ptrs[i]);
+	}
+
+	AllocDestroyHandle(&Handle);
+}
+
+
+typedef struct test_walk_context
+{
+	size_t Count;
+	size_t Sum;
+}
+test_walk_context;
+
+
+static void
+test_walk_func(
+	void* Ptr,
+	void* Context
+	)
+{
+	test_walk_context* Walk = Context;
+
+	/* Every live object was tagged with its own index.
+	 */
+	AssertEQ(*(uint32_t*) Ptr % 3, 1);
+
+	++Walk->Count;
+	Walk->Sum += *(uint32_t*) Ptr;
+}
+
+
+/* Bitmap handles of any size enumerate exactly their live objects.
+ */
+void
+test_walk(
+	void
+	)
+{
+	AllocHandleInfo Info =
+	{
+		.AllocSize = 48,
+		.BlockSize = 1 << 16,
+		.Alignment = 16,
+		.Type = ALLOC_HANDLE_TYPE_BITMAP
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+
+	/* Enough for a few blocks.
+	 */
+	size_t Count = 6000;
+	uint8_t** Ptrs = malloc(Count * sizeof(*Ptrs));
+	AssertNEQ(Ptrs, NULL);
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		Ptrs[i] = AllocAllocH(&Handle, Info.AllocSize, 0);
+		AssertNEQ(Ptrs[i], NULL);
+
+		*(uint32_t*) Ptrs[i] = i;
+	}
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		if(i % 3 != 1)
+		{
+			AllocFreeH(&Handle, Ptrs[i], Info.AllocSize);
+		}
+	}
+
+	test_walk_context Walk = {0};
+	AllocHandleWalkH(&Handle, test_walk_func, &Walk);
+
+	size_t Live = Count / 3;
+
+	AssertEQ(Walk.Count, Live);
+	AssertEQ(Walk.Sum, Live * (3 * Live - 1) / 2);
+
+	for(size_t i = 1; i < Count; i += 3)
+	{
+		AllocFreeH(&Handle, Ptrs[i], Info.AllocSize);
+	}
+
+	Walk = (test_walk_context){0};
+	AllocHandleWalkH(&Handle, test_walk_func, &Walk);
+
+	AssertEQ(Walk.Count, 0);
+
+	free(Ptrs);
+
+	AllocDestroyHandle(&Handle);
+}
+
+
+/* Extents are whole pages carved out of chunks one after another, freed ones
+ * merge with their free neighbors, and bigger objects get their own memory.
+ * States only use extents when asked to, so the default state still aligns
+ * big objects to the next power of 2.
+ */
+void
+test_extent(
+	void
+	)
+{
+	size_t PageSize = AllocGetPageSize();
+
+	AllocHandleInfo Info =
+	{
+		.AllocSize = PageSize * 16,
+		.BlockSize = PageSize * 256,
+		.Alignment = PageSize,
+		.Type = ALLOC_HANDLE_TYPE_EXTENT
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+
+	alloc_t Sizes[4] = { 1, PageSize + 1, PageSize * 3, PageSize };
+	uint8_t* Ptrs[4];
+
+	for(size_t i = 0; i < 4; ++i)
+	{
+		Ptrs[i] = AllocAllocH(&Handle, Sizes[i], 1);
+		AssertNEQ(Ptrs[i], NULL);
+		AssertEQ((uintptr_t) Ptrs[i] % PageSize, 0);
+
+		(void) memset(Ptrs[i], 0xFF, Sizes[i]);
+	}
+
+	AssertEQ(Ptrs[1], Ptrs[0] + PageSize);
+	AssertEQ(Ptrs[2], Ptrs[1] + PageSize * 2);
+	AssertEQ(Ptrs[3], Ptrs[2] + PageSize * 3);
+
+	/* The same number of pages stays in place.
+	 */
+	AssertEQ(AllocReallocH(&Handle, Ptrs[2], Sizes[2],
+		&Handle, PageSize * 2 + 1, 0), Ptrs[2]);
+	Sizes[2] = PageSize * 2 + 1;
+
+	AllocFreeH(&Handle, Ptrs[0], Sizes[0]);
+	AllocFreeH(&Handle, Ptrs[2], Sizes[2]);
+	AllocFreeH(&Handle, Ptrs[1], Sizes[1]);
+
+	uint8_t* Merged = AllocAllocH(&Handle, PageSize * 6, 0);
+	AssertEQ(Merged, Ptrs[0]);
+
+	alloc_t BigSize = Info.AllocSize + 1;
+	uint8_t* Big = AllocAllocH(&Handle, BigSize, 1);
+	AssertNEQ(Big, NULL);
+	AssertEQ(Big[BigSize - 1], 0);
+
+	AllocFreeH(&Handle, Big, BigSize);
+	AllocFreeH(&Handle, Merged, PageSize * 6);
+	AllocFreeH(&Handle, Ptrs[3], Sizes[3]);
+
+	AllocDestroyHandle(&Handle);
+
+	const AllocState* State = AllocGetGlobalState();
+
+	for(alloc_t Size = 1 << 19; Size <= 1 << 22; Size <<= 1)
+	{
+		void* Ptr = AllocAllocS(State, Size - 1, 0);
+		AssertNEQ(Ptr, NULL);
+		AssertEQ((uintptr_t) Ptr % Size, 0);
+
+		AllocFreeS(State, Size - 1, Ptr);
+	}
+}
+
+
+/* Buddy objects are aligned to their rounded size and do not overlap, and
+ * freeing all small objects of a block merges them back into big ones.
+ */
+void
+test_buddy(
+	void
+	)
+{
+	size_t PageSize = AllocGetPageSize();
+
+	AllocHandleInfo Info =
+	{
+		.AllocSize = PageSize,
+		.BlockSize = PageSize * 4,
+		.Alignment = 16,
+		.Type = ALLOC_HANDLE_TYPE_BUDDY
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+	AllocHandleSetFlagsH(&Handle, ALLOC_HANDLE_FLAG_DO_NOT_FREE);
+
+	enum { Count = 4096 };
+	static uint8_t* Ptrs[Count];
+	static alloc_t Sizes[Count];
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		Sizes[i] = (i * 7919) % 300 + 1;
+		Ptrs[i] = AllocAllocH(&Handle, Sizes[i], 0);
+		AssertNEQ(Ptrs[i], NULL);
+
+		alloc_t Rounded = 16;
+		while(Rounded < Sizes[i])
+		{
+			Rounded <<= 1;
+		}
+
+		AssertEQ((uintptr_t) Ptrs[i] % Rounded, 0);
+		(void) memset(Ptrs[i], (int) i, Sizes[i]);
+	}
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		uint8_t Tag = (uint8_t) i;
+
+		AssertEQ(Ptrs[i][0], Tag);
+		AssertEQ(Ptrs[i][Sizes[i] - 1], Tag);
+	}
+
+	/* Every other object goes, and the holes are filled again.
+	 */
+	for(size_t i = 0; i < Count; i += 2)
+	{
+		AllocFreeH(&Handle, Ptrs[i], Sizes[i]);
+	}
+
+	for(size_t i = 0; i < Count; i += 2)
+	{
+		Ptrs[i] = AllocAllocH(&Handle, Sizes[i], 0);
+		AssertNEQ(Ptrs[i], NULL);
+		(void) memset(Ptrs[i], (int) i, Sizes[i]);
+	}
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		uint8_t Tag = (uint8_t) i;
+
+		AssertEQ(Ptrs[i][0], Tag);
+		AssertEQ(Ptrs[i][Sizes[i] - 1], Tag);
+	}
+
+	/* Once everything is freed, the blocks kept around hold objects of the
+	 * biggest size again, three each past the header, so that many fit
+	 * before a new block is needed.
+	 */
+	uintptr_t BlockMask = ~(uintptr_t) (Info.BlockSize - 1);
+	static uintptr_t Blocks[Count];
+	size_t BlockCount = 0;
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		uintptr_t Block = (uintptr_t) Ptrs[i] & BlockMask;
+		size_t j = 0;
+
+		while(j < BlockCount && Blocks[j] != Block)
+		{
+			++j;
+		}
+
+		if(j == BlockCount)
+		{
+			Blocks[BlockCount++] = Block;
+		}
+
+		AllocFreeH(&Handle, Ptrs[i], Sizes[i]);
+	}
+
+	size_t Big = BlockCount * 3;
+	AssertLE(Big, Count);
+
+	for(size_t i = 0; i < Big; ++i)
+	{
+		Ptrs[i] = AllocAllocH(&Handle, Info.AllocSize, 0);
+		AssertNEQ(Ptrs[i], NULL);
+		AssertEQ((uintptr_t) Ptrs[i] % Info.AllocSize, 0);
+
+		uintptr_t Block = (uintptr_t) Ptrs[i] & BlockMask;
+		size_t j = 0;
+
+		while(j < BlockCount && Blocks[j] != Block)
+		{
+			++j;
+		}
+
+		AssertNEQ(j, BlockCount);
+	}
+
+	for(size_t i = 0; i < Big; ++i)
+	{
+		AllocFreeH(&Handle, Ptrs[i], Info.AllocSize);
+	}
+
+	/* A reset gives the lists back along with the blocks, and the handle
+	 * starts over.
+	 */
+	AllocHandleResetH(&Handle);
+
+	uint8_t* Ptr = AllocAllocH(&Handle, Info.AllocSize, 1);
+	AssertNEQ(Ptr, NULL);
+	AssertEQ(Ptr[Info.AllocSize - 1], 0);
+
+	AllocFreeH(&Handle, Ptr, Info.AllocSize);
+
+	AllocDestroyHandle(&Handle);
+}
+
+
+/* Arena objects are laid out one after another, freeing them does nothing,
+ * and a reset starts over at the beginning of the first block.
+ */
+void
+test_arena(
+	void
+	)
+{
+	size_t PageSize = AllocGetPageSize();
+
+	AllocHandleInfo Info =
+	{
+		.AllocSize = 1024,
+		.BlockSize = PageSize * 4,
+		.Alignment = 16,
+		.Type = ALLOC_HANDLE_TYPE_ARENA
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+
+	uint8_t* First = AllocAllocH(&Handle, 10, 0);
+	AssertNEQ(First, NULL);
+	AssertEQ((uintptr_t) First % 16, 0);
+	(void) memset(First, 0xFF, 10);
+
+	uint8_t* Second = AllocAllocH(&Handle, 100, 0);
+	AssertEQ(Second, First + 16);
+
+	/* Freeing does not give anything back, not even the last object.
+	 */
+	AllocFreeH(&Handle, Second, 100);
+
+	uint8_t* Third = AllocAllocH(&Handle, 1, 0);
+	AssertEQ(Third, Second + 112);
+
+	(void) memset(Third, 0xAB, 1);
+	uint8_t* Moved = AllocReallocH(&Handle, Third, 1, &Handle, 500, 0);
+	AssertNEQ(Moved, NULL);
+	AssertEQ(Moved[0], 0xAB);
+
+	/* Enough to take a few more blocks.
+	 */
+	size_t Count = Info.BlockSize / Info.AllocSize * 4;
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		uint8_t* Ptr = AllocAllocH(&Handle, Info.AllocSize, 0);
+		AssertNEQ(Ptr, NULL);
+		(void) memset(Ptr, 0xFF, Info.AllocSize);
+	}
+
+	AllocArenaResetH(&Handle);
+
+	uint8_t* Again = AllocAllocH(&Handle, 10, 1);
+	AssertEQ(Again, First);
+	AssertEQ(Again[9], 0);
+
+	AllocArenaReleaseH(&Handle);
+
+	uint8_t* Fresh = AllocAllocH(&Handle, 10, 1);
+	AssertNEQ(Fresh, NULL);
+	AssertEQ(Fresh[0], 0);
+
+	AllocDestroyHandle(&Handle);
+}
+
+
+/* Stack objects are freed in reverse order, resizing the most recent one
+ * keeps it on top, and restoring a mark frees everything after it.
+ */
+void
+test_stack(
+	void
+	)
+{
+	size_t PageSize = AllocGetPageSize();
+
+	AllocHandleInfo Info =
+	{
+		.AllocSize = 1024,
+		.BlockSize = PageSize * 4,
+		.Alignment = 16,
+		.Type = ALLOC_HANDLE_TYPE_STACK
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+
+	uint8_t* First = AllocAllocH(&Handle, 100, 0);
+	AssertNEQ(First, NULL);
+
+	uint8_t* Second = AllocAllocH(&Handle, 100, 0);
+	AssertEQ(Second, First + 112);
+
+	/* Shrinking the top object in place still lets it be popped.
+	 */
+	AssertEQ(AllocReallocH(&Handle, Second, 100, &Handle, 10, 0), Second);
+	AllocFreeH(&Handle, Second, 10);
+
+	uint8_t* Third = AllocAllocH(&Handle, 10, 0);
+	AssertEQ(Third, Second);
+
+	/* So does growing it, as long as it fits in the block.
+	 */
+	(void) memset(Third, 0xFF, 10);
+	AssertEQ(AllocReallocH(&Handle, Third, 10, &Handle, 200, 1), Third);
+	AssertEQ(Third[9], 0xFF);
+	AssertEQ(Third[10], 0);
+	AssertEQ(Third[199], 0);
+
+	AllocFreeH(&Handle, Third, 200);
+	AssertEQ(AllocAllocH(&Handle, 1, 0), Third);
+	AllocFreeH(&Handle, Third, 1);
+
+	/* The objects below the top can only shrink.
+	 */
+	AssertEQ(AllocReallocH(&Handle, First, 100, &Handle, 50, 0), First);
+
+	uint8_t* Top = AllocAllocH(&Handle, 16, 0);
+	uint8_t* Moved = AllocReallocH(&Handle, First, 50, &Handle, 60, 0);
+	AssertEQ(Moved, Top + 16);
+
+	/* Popping the first object of a block makes the last one of the block
+	 * before it the most recent again.
+	 */
+	uintptr_t BlockMask = ~(uintptr_t) (Info.BlockSize - 1);
+	uint8_t* Last = AllocAllocH(&Handle, Info.AllocSize, 0);
+	uint8_t* Next = AllocAllocH(&Handle, Info.AllocSize, 0);
+
+	while(((uintptr_t) Next & BlockMask) == ((uintptr_t) Last & BlockMask))
+	{
+		Last = Next;
+		Next = AllocAllocH(&Handle, Info.AllocSize, 0);
+		AssertNEQ(Next, NULL);
+	}
+
+	AllocFreeH(&Handle, Next, Info.AllocSize);
+
+	uintptr_t LastEnd = (uintptr_t) Last + Info.AllocSize;
+	AssertEQ(AllocStackMarkH(&Handle), LastEnd);
+
+	AllocFreeH(&Handle, Last, Info.AllocSize);
+	AssertEQ(AllocAllocH(&Handle, Info.AllocSize, 0), Last);
+
+	/* Restoring a mark pops everything after it, blocks included.
+	 */
+	alloc_t Mark = AllocStackMarkH(&Handle);
+	size_t Count = Info.BlockSize / Info.AllocSize * 4;
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		AssertNEQ(AllocAllocH(&Handle, Info.AllocSize, 0), NULL);
+	}
+
+	AllocStackRestoreH(&Handle, Mark);
+	AssertEQ(AllocStackMarkH(&Handle), Mark);
+
+	uint8_t* After = AllocAllocH(&Handle, 16, 0);
+	alloc_t Aligned = (Mark + 15) & ~(alloc_t) 15;
+	AssertEQ((uintptr_t) After, Aligned);
+	AssertEQ(After, Last + Info.AllocSize);
+
+	AllocDestroyHandle(&Handle);
+}
+
+
+void
+test_fullest_type(
+	AllocHandleType Type
+	)
+{
+	size_t PageSize = AllocGetPageSize();
+
+	AllocHandleInfo Info =
+	{
+		.AllocSize = PageSize / 64,
+		.BlockSize = PageSize,
+		.Alignment = 16,
+		.Type = Type
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+
+	enum { Count = 512 };
+	static uint8_t* Ptrs[Count];
+
+	uintptr_t BlockMask = ~(uintptr_t) (Info.BlockSize - 1);
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		Ptrs[i] = AllocAllocH(&Handle, Info.AllocSize, 0);
+		AssertNEQ(Ptrs[i], NULL);
+	}
+
+	/* The first two blocks are full. Most of the first one is freed, and
+	 * only two objects of the second one.
+	 */
+	uintptr_t Empty = (uintptr_t) Ptrs[0] & BlockMask;
+	uintptr_t Full = 0;
+
+	for(size_t i = 0; i < Count && !Full; ++i)
+	{
+		uintptr_t Block = (uintptr_t) Ptrs[i] & BlockMask;
+
+		if(Block != Empty)
+		{
+			Full = Block;
+		}
+	}
+
+	size_t FullFree = 0;
+	size_t EmptyFree = 0;
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		uintptr_t Block = (uintptr_t) Ptrs[i] & BlockMask;
+
+		if(
+			(Block == Empty && i % 4 != 0) ||
+			(Block == Full && FullFree < 2)
+			)
+		{
+			AllocFreeH(&Handle, Ptrs[i], Info.AllocSize);
+			Ptrs[i] = NULL;
+
+			if(Block == Empty)
+			{
+				++EmptyFree;
+			}
+			else
+			{
+				++FullFree;
+			}
+		}
+	}
+
+	AssertEQ(FullFree, 2);
+	AssertGE(EmptyFree, 16);
+
+	/* Once the block being allocated from fills up, the fullest one goes
+	 * first, so the emptiest one is only reused after it.
+	 */
+	size_t Extra = 0;
+	static uint8_t* Extras[Count];
+
+	for(; Extra < Count; ++Extra)
+	{
+		Extras[Extra] = AllocAllocH(&Handle, Info.AllocSize, 0);
+		AssertNEQ(Extras[Extra], NULL);
+
+		uintptr_t Block = (uintptr_t) Extras[Extra] & BlockMask;
+
+		if(Block == Full)
+		{
+			--FullFree;
+		}
+
+		if(Block == Empty)
+		{
+			AssertEQ(FullFree, 0);
+			++Extra;
+
+			break;
+		}
+	}
+
+	AssertNEQ(Extra, Count);
+
+	for(size_t i = 0; i < Extra; ++i)
+	{
+		AllocFreeH(&Handle, Extras[i], Info.AllocSize);
+	}
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		if(Ptrs[i])
+		{
+			AllocFreeH(&Handle, Ptrs[i], Info.AllocSize);
+		}
+	}
+
+	AllocDestroyHandle(&Handle);
+}
+
+
+/* Free list and bitmap handles refill their fullest blocks first, so that
+ * the emptiest ones get the chance to drain.
+ */
+void
+test_fullest(
+	void
+	)
+{
+	test_fullest_type(ALLOC_HANDLE_TYPE_DEFAULT);
+	test_fullest_type(ALLOC_HANDLE_TYPE_BITMAP);
+}
+
+
+/* Fills blocks of `Handle` until a fifth one is taken, and then empties them
+ * in reverse. Returns what trimming the handle frees afterwards.
+ */
+static size_t
+test_spare_churn(
+	AllocHandle* Handle,
+	size_t AllocSize,
+	size_t BlockSize
+	)
+{
+	enum { Count = 8192 };
+	static void* Ptrs[Count];
+
+	size_t Limit = BlockSize / AllocSize;
+	size_t Used = 0;
+	uintptr_t Blocks[5] = {0};
+	size_t BlockCount = 0;
+
+	while(BlockCount < 5)
+	{
+		AssertLE(Used, Count - 1);
+
+		Ptrs[Used] = AllocAllocH(Handle, AllocSize, 0);
+		AssertNEQ(Ptrs[Used], NULL);
+
+		uintptr_t Block = (uintptr_t) Ptrs[Used] & ~(uintptr_t) (BlockSize - 1);
+
+		if(!BlockCount || Blocks[BlockCount - 1] != Block)
+		{
+			Blocks[BlockCount++] = Block;
+		}
+
+		++Used;
+	}
+
+	AssertLE(Used, Limit * 4 + 1);
+
+	for(size_t i = Used; i-- > 0;)
+	{
+		AllocFreeH(Handle, Ptrs[i], AllocSize);
+	}
+
+	return AllocHandleTrimH(Handle, 0);
+}
+
+
+/* The spare count is the number of empty blocks a handle keeps, `0` keeping
+ * one, and `ALLOC_SPARE_NONE` keeping none.
+ */
+void
+test_spare(
+	void
+	)
+{
+	size_t PageSize = AllocGetPageSize();
+
+	AllocHandleInfo Info =
+	{
+		.AllocSize = 64,
+		.BlockSize = PageSize,
+		.Alignment = 64
+	};
+
+	AllocHandle Handle = {0};
+	AllocCreateHandle(&Info, &Handle);
+	AssertEQ(AllocHandleGetSpareH(&Handle), 1);
+	AllocDestroyHandle(&Handle);
+
+	Info.Spare = ALLOC_SPARE_NONE;
+
+	AllocCreateHandle(&Info, &Handle);
+	AssertEQ(AllocHandleGetSpareH(&Handle), 0);
+
+	void* Ptr = AllocAllocH(&Handle, Info.AllocSize, 0);
+	AssertNEQ(Ptr, NULL);
+
+	AllocFreeH(&Handle, Ptr, Info.AllocSize);
+	AssertEQ(AllocHandleTrimH(&Handle, 0), 0);
+
+	AllocHandleSetSpareH(&Handle, 0);
+	AssertEQ(AllocHandleGetSpareH(&Handle), 1);
+
+	/* Only the first 2 blocks to go empty are kept.
+	 */
+	AllocHandleSetSpareH(&Handle, 2);
+	AssertEQ(AllocHandleGetSpareH(&Handle), 2);
+
+	size_t Trimmed = test_spare_churn(&Handle, Info.AllocSize, PageSize);
+	AssertEQ(Trimmed, PageSize * 2);
+
+	/* Counts too big to multiply by the objects per block keep them all.
+	 */
+	AllocHandleSetSpareH(&Handle, ALLOC_SPARE_NONE - 1);
+
+	Trimmed = test_spare_churn(&Handle, Info.AllocSize, PageSize);
+	AssertEQ(Trimmed, PageSize * 5);
+
+	AllocDestroyHandle(&Handle);
+}
+
+
+#ifdef __linux__
+
+
+/* Objects of a shared state can be handed to a forked child as they are, and
+ * freed by the parent when the child is done with them.
+ */
+void
+test_shared(
+	void
+	)
+{
+	int Fd;
+
+	AssertEQ(AllocAllocSharedState(
+		AllocGetFineStateInfo(), 1 << 26, &Fd), NULL);
+
+	const AllocState* State = AllocAllocSharedState(NULL, 1 << 26, &Fd);
+	AssertNEQ(State, NULL);
+
+	uint8_t** Ptr = AllocAllocS(State, sizeof(*Ptr), 1);
+	AssertNEQ(Ptr, NULL);
+
+	pid_t Pid = fork();
+	AssertNEQ(Pid, -1);
+
+	if(!Pid)
+	{
+		*Ptr = AllocAllocS(State, 256, 0);
+
+		if(*Ptr)
+		{
+			(void) memset(*Ptr, 0x5A, 256);
+		}
+
+		_exit(0);
+	}
+
+	int Status;
+	AssertEQ(waitpid(Pid, &Status, 0), Pid);
+	AssertEQ(WIFEXITED(Status), 1);
+
+	AssertNEQ(*Ptr, NULL);
+
+	for(size_t i = 0; i < 256; ++i)
+	{
+		AssertEQ((*Ptr)[i], 0x5A);
+	}
+
+	AllocFreeS(State, 256, *Ptr);
+	AllocFreeS(State, sizeof(*Ptr), Ptr);
+
+	AllocFreeState(State);
+	(void) close(Fd);
+}
+
+
+/* A persistent state gets its objects back when reopened, and a file whose
+ * state was never finished is created anew instead of refused forever.
+ */
+void
+test_persistent(
+	void
+	)
+{
+	char Path[] = "/tmp/alloc_test_XXXXXX";
+
+	int Fd = mkstemp(Path);
+	AssertNEQ(Fd, -1);
+
+	/* Sized, but the header is all zeros.
+	 */
+	AssertEQ(ftruncate(Fd, 1 << 20), 0);
+	(void) close(Fd);
+
+	const AllocState* State =
+		AllocOpenPersistentState(Path, NULL, 1 << 26, NULL);
+	AssertNEQ(State, NULL);
+
+	uint8_t* Ptr = AllocAllocS(State, 100, 0);
+	AssertNEQ(Ptr, NULL);
+
+	(void) memset(Ptr, 0x5A, 100);
+	AllocSetRootS(State, Ptr);
+
+	AssertEQ(AllocSyncS(State), 1);
+	AllocFreeState(State);
+
+	State = AllocOpenPersistentState(Path, NULL, 0, NULL);
+	AssertNEQ(State, NULL);
+
+	AssertEQ(AllocGetRootS(State), Ptr);
+
+	for(size_t i = 0; i < 100; ++i)
+	{
+		AssertEQ(Ptr[i], 0x5A);
+	}
+
+	AllocFreeS(State, 100, Ptr);
+	AllocFreeState(State);
+
+	(void) unlink(Path);
+}
+
+
+/* Real-time states serve objects of all sizes, big ones included, without
+ * a single system call after they are created.
+ */
+void
+test_realtime(
+	void
+	)
+{
+	AllocHandleInfo Handles[8];
+
+	for(size_t i = 0; i < 8; ++i)
+	{
+		Handles[i] = (AllocHandleInfo)
+		{
+			.AllocSize = 1 << i,
+			.BlockSize = 1 << 16,
+			.Alignment = 1 << i
+		};
+	}
+
+	AllocStateInfo Info =
+	{
+		.Handles = Handles,
+		.HandleCount = 8
+	};
+
+	/* Locking memory is subject to `RLIMIT_MEMLOCK`.
+	 */
+	const AllocState* State = AllocAllocRealtimeState(&Info, 1 << 22);
+	if(!State)
+	{
+		return;
+	}
+
+	void* Ptrs[256];
+
+	for(size_t Round = 0; Round < 2; ++Round)
+	{
+		for(size_t i = 0; i < 256; ++i)
+		{
+			Ptrs[i] = AllocAllocS(State, i % 128 + 1, 1);
+			AssertNEQ(Ptrs[i], NULL);
+		}
+
+		void* Big = AllocAllocS(State, 100000, 1);
+		AssertNEQ(Big, NULL);
+
+		AllocFreeS(State, 100000, Big);
+
+		for(size_t i = 0; i < 256; ++i)
+		{
+			AllocFreeS(State, i % 128 + 1, Ptrs[i]);
+		}
+	}
+
+	AssertEQ(AllocGetSyscallCountS(State), 0);
+
+	AllocFreeState(State);
+}
+
+
+/* Objects of compact states of any size get 32-bit references, with smaller
+ * ones rounded up, and handles whose objects cannot be referenced refuse to
+ * hand them out.
+ */
+void
+test_compact(
+	void
+	)
+{
+	const AllocState* State = AllocAllocCompactState(NULL, 1 << 26);
+	AssertNEQ(State, NULL);
+
+	uint32_t Refs[64];
+
+	for(size_t i = 0; i < 64; ++i)
+	{
+		Refs[i] = AllocAllocCompactS(State, i + 1, 1);
+		AssertNEQ(Refs[i], 0);
+
+		uint8_t* Ptr = AllocDecodeRefS(State, Refs[i]);
+		AssertEQ(((uintptr_t) Ptr & (ALLOC_COMPACT_SIZE_MIN - 1)), 0);
+		AssertEQ(AllocEncodeRefS(State, Ptr), Refs[i]);
+
+		(void) memset(Ptr, (uint8_t) i, i + 1);
+	}
+
+	for(size_t i = 0; i < 64; ++i)
+	{
+		uint8_t* Ptr = AllocDecodeRefS(State, Refs[i]);
+		AssertEQ(Ptr[i], (uint8_t) i);
+
+		AllocFreeCompactS(State, i + 1, Refs[i]);
+	}
+
+	AllocHandle* Handle = (void*) AllocGetHandleS(State, 1);
+	size_t Refused = 0;
+
+	for(size_t i = 0; i < ALLOC_COMPACT_SIZE_MIN; ++i)
+	{
+		Refs[i] = AllocAllocCompactH(Handle, 1, 0);
+		Refused += !Refs[i];
+	}
+
+	AssertNEQ(Refused, 0);
+
+	for(size_t i = 0; i < ALLOC_COMPACT_SIZE_MIN; ++i)
+	{
+		AllocFreeCompactH(Handle, Refs[i], 1);
+	}
+
+	AllocFreeState(State);
+}
+
+
+/* Trimming counts what goes back to the system, which blocks of states that
+ * keep their memory dirty never do.
+ */
+void
+test_trim(
+	void
+	)
+{
+	AllocHandleInfo Handles[1] =
+	{
+		{
+			.AllocSize = 4096,
+			.BlockSize = 1 << 16,
+			.Alignment = 4096
+		}
+	};
+
+	AllocStateInfo Info =
+	{
+		.Handles = Handles,
+		.HandleCount = 1
+	};
+
+	/* Locking memory is subject to `RLIMIT_MEMLOCK`.
+	 */
+	const AllocState* States[2] =
+	{
+		AllocAllocState(NULL),
+		AllocAllocRealtimeState(&Info, 1 << 22)
+	};
+
+	for(size_t i = 0; i < 2; ++i)
+	{
+		if(!States[i])
+		{
+			AssertEQ(i, 1);
+			continue;
+		}
+
+		void* Ptr = AllocAllocS(States[i], 4096, 0);
+		AssertNEQ(Ptr, NULL);
+
+		(void) memset(Ptr, 0xFF, 4096);
+		AllocFreeS(States[i], 4096, Ptr);
+
+		alloc_t Released = AllocTrimState(States[i], 0);
+
+		if(i == 0)
+		{
+			AssertGE(Released, 4096);
+		}
+		else
+		{
+			AssertEQ(Released, 0);
+		}
+
+		AssertEQ(AllocTrimState(States[i], 0), 0);
+
+		AllocFreeState(States[i]);
+	}
+}
+
+
+/* I/O states have one handle per size class from a page up, and their range
+ * splits into pieces that can be registered with `io_uring`.
+ */
+void
+test_io(
+	void
+	)
+{
+	alloc_t RangeSize = (alloc_t) 5 << 29;
+	const AllocState* State = AllocAllocIoState(RangeSize);
+	AssertNEQ(State, NULL);
+
+	size_t PageSize = AllocGetPageSize();
+	alloc_t Classes = 0;
+
+	for(size_t Size = PageSize; Size <= ALLOC_IO_SIZE_MAX; Size <<= 1)
+	{
+		++Classes;
+	}
+
+	AssertEQ(State->HandleCount, Classes + 1);
+	AssertEQ(AllocGetHandleS(State, 1), &State->Handles[0]);
+	AssertEQ(AllocGetHandleS(State, PageSize), &State->Handles[0]);
+	AssertEQ(AllocGetHandleS(State, PageSize + 1), &State->Handles[1]);
+
+	void* Ptr = AllocAllocS(State, 1, 1);
+	AssertNEQ(Ptr, NULL);
+	AssertEQ((uintptr_t) Ptr % PageSize, 0);
+
+	void* Base;
+	alloc_t Size;
+	AssertEQ(AllocGetRangeS(State, &Base, &Size), 1);
+	AssertEQ(Size, RangeSize);
+
+	uint8_t* Next = Base;
+	alloc_t Index = 0;
+	void* PartBase;
+	alloc_t PartSize;
+
+	for(; AllocGetRangePartS(State, Index, &PartBase, &PartSize); ++Index)
+	{
+		AssertEQ(PartBase, Next);
+		AssertLE(PartSize, ALLOC_RANGE_PART_SIZE);
+
+		Next += PartSize;
+
+		if(Next != (uint8_t*) Base + Size)
+		{
+			AssertEQ((uintptr_t) Next % ALLOC_RANGE_PART_SIZE, 0);
+		}
+	}
+
+	AssertEQ(Next, (uint8_t*) Base + Size);
+	AssertGE(Index, 3);
+
+	AllocFreeS(State, 1, Ptr);
+	AllocFreeState(State);
+}
+
+
+/* Resetting frees every object at once, those with their own virtual memory
+ * included.
+ */
+void
+test_reset(
+	void
+	)
+{
+	AllocHandle Handle = {0};
+	AllocCreateHandle(NULL, &Handle);
+
+	size_t PageSize = AllocGetPageSize();
+	unsigned char Resident;
+
+	/* Enough for the table to grow twice.
+	 */
+	size_t Count = 1024;
+	uint8_t** Ptrs = malloc(Count * sizeof(*Ptrs));
+	AssertNEQ(Ptrs, NULL);
+
+	for(size_t i = 0; i < Count; ++i)
+	{
+		Ptrs[i] = AllocAllocH(&Handle, PageSize, 0);
+		AssertNEQ(Ptrs[i], NULL);
+
+		Ptrs[i][0] = (uint8_t) i;
+	}
+
+	/* Holes and moved objects shuffle the table around.
+	 */
+	for(size_t i = 0; i < Count; ++i)
+	{
+		if(i % 2)
+		{
+			AllocFreeH(&Handle, Ptrs[i], PageSize);
+			Ptrs[i] = NULL;
+		}
+		else if(i % 4 == 0)
+		{
+			Ptrs[i] = AllocReallocH(&Handle, Ptrs[i], PageSize,
+				&Handle, PageSize * 2, 0);
+			AssertNEQ(Ptrs[i], NULL);
+			AssertEQ(Ptrs[i][0], (uint8_t) i);
+		}
+	}
+
+	AllocHandleResetH(&Handle);
+
+	for(size_t i = 0; i < Count; i += 2)
+	{
+		AssertEQ(mincore(Ptrs[i], PageSize, &Resident), -1);
+		AssertEQ(errno, ENOMEM);
+	}
+
+	free(Ptrs);
+
+	uint8_t* Ptr = AllocAllocH(&Handle, PageSize, 1);
+	AssertNEQ(Ptr, NULL);
+
+	AllocDestroyHandle(&Handle);
+
+	AssertEQ(mincore(Ptr, PageSize, &Resident), -1);
+
+	/* Bigger than any handle of the default state.
+	 */
+	const AllocState* State = AllocAllocState(NULL);
+	AssertNEQ(State, NULL);
+
+	size_t Size = (size_t) 1 << 27;
+	Ptr = AllocAllocS(State, Size, 0);
+	AssertNEQ(Ptr, NULL);
+
+	Ptr[0] = 1;
+
+	AllocResetState(State);
+
+	AssertEQ(mincore(Ptr, PageSize, &Resident), -1);
+	AssertEQ(errno, ENOMEM);
+
+	AllocFreeState(State);
+}
+
+
+/* Under pressure, the reclaim agent frees the empty blocks that registered
+ * states keep around. Pressure is read from a stand-in PSI file.
+ */
+void
+test_reclaim(
+	void
+	)
+{
+	char Path[] = "/tmp/alloc_test_XXXXXX";
+
+	int Fd = mkstemp(Path);
+	AssertNEQ(Fd, -1);
+
+	const char Line[] = "some avg10=25.50 avg60=0.00 avg300=0.00 total=0\n";
+	AssertEQ(write(Fd, Line, sizeof(Line) - 1), (ssize_t) sizeof(Line) - 1);
+	(void) close(Fd);
+
+	const AllocState* State = AllocAllocState(NULL);
+	AssertNEQ(State, NULL);
+
+	AllocHandle* Handle = (void*) AllocGetHandleS(State, 64);
+
+	void* Ptr = AllocAllocH(Handle, 64, 0);
+	AssertNEQ(Ptr, NULL);
+
+	AllocFreeH(Handle, Ptr, 64);
+
+	/* A spare count set for a handle is kept even under pressure.
+	 */
+	AllocHandle* Own = (void*) AllocGetHandleS(State, 4096);
+	AllocHandleSetSpareH(Own, 5);
+
+	AllocReclaimInfo Info =
+	{
+		.Path = Path,
+		.Interval = 10,
+		.Threshold = 2550
+	};
+
+	AssertEQ(AllocRegisterState(State), 1);
+	AssertEQ(AllocStartReclaimAgent(&Info), 1);
+
+	(void) usleep(200000);
+
+	AssertEQ(AllocHandleGetSpareH(Handle), 0);
+	AssertEQ(AllocHandleGetSpareH(Own), 5);
+
+	AllocStopReclaimAgent();
+	AllocUnregisterState(State);
+
+	/* The block is gone, and so is its mapping.
+	 */
+	size_t PageSize = AllocGetPageSize();
+	void* Page = (void*) ((uintptr_t) Ptr & ~(uintptr_t) (PageSize - 1));
+	unsigned char Resident;
+
+	AssertEQ(mincore(Page, PageSize, &Resident), -1);
+	AssertEQ(errno, ENOMEM);
+
+	AllocFreeState(State);
+
+	(void) unlink(Path);
+}
+
+
+#endif /* __linux__ */
+
+
+#endif /* DEV_ALLOC */
+
+
 #include <time.h>
 #include <unistd.h>
 
@@ -111,6 +1975,37 @@ main(
 		test(i, Shuffle);
 	}
 
+#ifdef DEV_ALLOC
+	test_headers();
+	test_colors();
+	test_fine();
+	test_nursery();
+	test_zero();
+	test_block_size();
+	test_small_index();
+	test_fast_paths();
+	test_inverse_divide();
+	test_bitmap();
+	test_walk();
+	test_extent();
+	test_buddy();
+	test_arena();
+	test_stack();
+	test_fullest();
+	test_spare();
+
+	#ifdef __linux__
+		test_shared();
+		test_persistent();
+		test_realtime();
+		test_compact();
+		test_trim();
+		test_io();
+		test_reset();
+		test_reclaim();
+	#endif
+#endif
+
 	puts("pass");
 
 	return 0;
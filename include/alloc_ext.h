@@ -36,6 +36,64 @@ AllocGetHandle(
 }
 
 
+/* `AllocGetOffsetS` - Convert a pointer allocated from a state to an offset.
+ *
+ * Offsets are relative to the state, and `0` stands for `NULL`. They are meant
+ * for passing objects of shared states (see `AllocAllocSharedState`) through
+ * channels that should not carry raw pointers.
+ */
+_inline_ _const_func_ alloc_t
+AllocGetOffsetS(
+	_in_ AllocState* State,
+	_in_opt_ void* Ptr
+	)
+{
+	return Ptr ? (uintptr_t) Ptr - (uintptr_t) State : 0;
+}
+
+
+/* `AllocGetPtrS` - Convert an offset back to a pointer.
+ *
+ * See `AllocGetOffsetS` for more information.
+ */
+_inline_ _const_func_ void*
+AllocGetPtrS(
+	_in_ AllocState* State,
+	alloc_t Offset
+	)
+{
+	return Offset ? (uint8_t*) State + Offset : NULL;
+}
+
+
+/* `AllocEncodeRefS` - Convert a pointer to a reference of a compact state.
+ *
+ * See `AllocAllocCompactState` for more information. `NULL` becomes `0`.
+ */
+_inline_ _const_func_ uint32_t
+AllocEncodeRefS(
+	_in_ AllocState* State,
+	_in_opt_ void* Ptr
+	)
+{
+	return AllocGetOffsetS(State, Ptr) >> ALLOC_COMPACT_SHIFT;
+}
+
+
+/* `AllocDecodeRefS` - Convert a reference of a compact state to a pointer.
+ *
+ * See `AllocAllocCompactState` for more information. `0` becomes `NULL`.
+ */
+_inline_ _const_func_ void*
+AllocDecodeRefS(
+	_in_ AllocState* State,
+	uint32_t Ref
+	)
+{
+	return AllocGetPtrS(State, (alloc_t) Ref << ALLOC_COMPACT_SHIFT);
+}
+
+
 _inline_ void
 AllocHandleLockS(
 	_in_ AllocState* State,
@@ -249,6 +307,22 @@ AllocAllocS(
 }
 
 
+_inline_ uint32_t
+AllocAllocCompactS(
+	_in_ AllocState* State,
+	alloc_t Size,
+	int Zero
+	)
+{
+	if(Size < ALLOC_COMPACT_SIZE_MIN)
+	{
+		Size = ALLOC_COMPACT_SIZE_MIN;
+	}
+
+	return AllocAllocCompactH(AllocGetHandleS(State, Size), Size, Zero);
+}
+
+
 _inline_ void*
 AllocAllocUS(
 	_in_ AllocState* State,
@@ -291,6 +365,22 @@ AllocFreeS(
 }
 
 
+_inline_ void
+AllocFreeCompactS(
+	_in_ AllocState* State,
+	alloc_t Size,
+	uint32_t Ref
+	)
+{
+	if(Size < ALLOC_COMPACT_SIZE_MIN)
+	{
+		Size = ALLOC_COMPACT_SIZE_MIN;
+	}
+
+	AllocFreeCompactH(AllocGetHandleS(State, Size), Ref, Size);
+}
+
+
 _inline_ void
 AllocFreeUS(
 	_in_ AllocState* State,
@@ -0,0 +1,225 @@
+/*
+ *   Copyright 2024 Franciszek Balcerak
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Inlined allocation fast paths. They make no calls at all when the handle's
+ * first block has a free object to spare, and fall back to `AllocAllocUH`
+ * otherwise. Zeroing allocations, and the allocation that fills a block up,
+ * always take the slow path.
+ *
+ * All of them are unlocked, see `AllocHandleLockH`. The results are the same
+ * as those of `AllocAllocUH`, and objects are freed with `AllocFreeUH` or
+ * any other free function as usual.
+ */
+
+#include "alloc_internal.h"
+
+#include <string.h>
+
+#ifndef _inline_
+	#define _inline_ __attribute__((always_inline)) inline
+#endif
+
+#define ALLOC_LIKELY(X) __builtin_expect(!!(X), 1)
+
+
+/* `AllocGetHandleFastS` - Same as `AllocGetHandleS`, but with the lookup
+ * of small sizes inlined.
+ */
+_inline_ _pure_func_ _opaque_ AllocHandle*
+AllocGetHandleFastS(
+	_in_ AllocState* State,
+	alloc_t Size
+	)
+{
+	/* Also rules out `0`, which wraps around.
+	 */
+	if(Size - 1 < ALLOC_SMALL_INDEX_MAX)
+	{
+		uint8_t Small =
+			State->SmallIndex[(Size - 1) >> ALLOC_SMALL_INDEX_SHIFT];
+
+		if(Small != ALLOC_SMALL_INDEX_NONE)
+		{
+			return &State->Handles[Small];
+		}
+	}
+
+	return AllocGetHandleS(State, Size);
+}
+
+
+/* `AllocAlloc1FastUH` - `AllocAllocUH` for handles of `AllocSize = 1`.
+ */
+_inline_ void*
+AllocAlloc1FastUH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	AllocHandleInternal* HandleInternal = (AllocHandleInternal*) Handle;
+	Alloc1Block* Block = (Alloc1Block*) HandleInternal->Head;
+
+	if(ALLOC_LIKELY(Size && !Zero && Block))
+	{
+		Alloc1* Alloc = &Block->Allocs[Block->Free];
+
+		if(ALLOC_LIKELY(Alloc->Count + 1 < ALLOC1_MAX))
+		{
+			++HandleInternal->Allocations;
+			++Block->Count;
+			++Alloc->Count;
+
+			if(Alloc->Free != UINT8_MAX)
+			{
+				uint8_t* Ptr = Alloc->Data + Alloc->Free;
+				Alloc->Free = *Ptr;
+
+				return Ptr;
+			}
+
+			return Alloc->Data + Alloc->Used++;
+		}
+	}
+
+	return AllocAllocUH(Handle, Size, Zero);
+}
+
+
+/* `AllocAlloc2FastUH` - `AllocAllocUH` for handles of `AllocSize = 2`.
+ */
+_inline_ void*
+AllocAlloc2FastUH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	AllocHandleInternal* HandleInternal = (AllocHandleInternal*) Handle;
+	Alloc2* Alloc = (Alloc2*) HandleInternal->Head;
+
+	if(ALLOC_LIKELY(
+		Size && !Zero && Alloc &&
+		Alloc->Count + 1u < HandleInternal->AllocLimit
+		))
+	{
+		++HandleInternal->Allocations;
+		++Alloc->Count;
+
+		uint8_t* Data = (uint8_t*) (((uintptr_t) Alloc +
+			HandleInternal->Padding) & HandleInternal->DataMask);
+
+		if(Alloc->Free != ALLOC2_MAX)
+		{
+			uint8_t* Ptr = Data + Alloc->Free * 2;
+			(void) memcpy(&Alloc->Free, Ptr, 2);
+
+			return Ptr;
+		}
+
+		return Data + Alloc->Used++ * 2;
+	}
+
+	return AllocAllocUH(Handle, Size, Zero);
+}
+
+
+/* `AllocAlloc4FastUH` - `AllocAllocUH` for handles of `AllocSize > 2`.
+ */
+_inline_ void*
+AllocAlloc4FastUH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	AllocHandleInternal* HandleInternal = (AllocHandleInternal*) Handle;
+	Alloc4* Alloc = (Alloc4*) HandleInternal->Head;
+
+	if(ALLOC_LIKELY(
+		Size && !Zero && Alloc &&
+		Alloc->Count + 1 < Alloc->Limit
+		))
+	{
+		++HandleInternal->Allocations;
+		++Alloc->Count;
+
+		uint8_t* Data = (uint8_t*) (((uintptr_t) Alloc +
+			HandleInternal->Padding) & HandleInternal->DataMask);
+
+		if(Alloc->Free != ALLOC4_MAX)
+		{
+			uint8_t* Ptr = Data + Alloc->Free * HandleInternal->AllocSize;
+			(void) memcpy(&Alloc->Free, Ptr, 4);
+
+			return Ptr;
+		}
+
+		return Data + Alloc->Used++ * HandleInternal->AllocSize;
+	}
+
+	return AllocAllocUH(Handle, Size, Zero);
+}
+
+
+/* `AllocAllocFastUH` - `AllocAllocUH` with the fast path of the handle's
+ * engine inlined.
+ *
+ * The engine is picked with a switch rather than through a table, so when
+ * the handle is known at compile time, the other engines are optimized away.
+ * Otherwise, prefer the engine specific function if you know the engine.
+ */
+_inline_ void*
+AllocAllocFastUH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	AllocHandleInternal* HandleInternal = (AllocHandleInternal*) Handle;
+
+	switch(HandleInternal->Engine)
+	{
+
+	case 1: return AllocAlloc1FastUH(Handle, Size, Zero);
+	case 2: return AllocAlloc2FastUH(Handle, Size, Zero);
+	case 3: return AllocAlloc4FastUH(Handle, Size, Zero);
+	default: return AllocAllocUH(Handle, Size, Zero);
+
+	}
+}
+
+
+_inline_ void*
+AllocAllocFastUS(
+	_in_ AllocState* State,
+	alloc_t Size,
+	int Zero
+	)
+{
+	return AllocAllocFastUH(AllocGetHandleFastS(State, Size), Size, Zero);
+}
+
+
+#ifdef __cplusplus
+}
+#endif
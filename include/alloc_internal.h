@@ -0,0 +1,385 @@
+/*
+ *   Copyright 2024 Franciszek Balcerak
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The layout of handles and blocks. Private, it can change in any release.
+ * It is only public so that `alloc_fast.h` can inline the fast paths. Use
+ * the functions of `alloc_std.h` instead.
+ */
+
+#include "alloc_std.h"
+
+#include <assert.h>
+
+#ifndef _packed_
+	#define _packed_ __attribute__((packed))
+#endif
+
+
+#if __SIZEOF_POINTER__ == 8
+	#define ALLOC1_MAX 250
+#else
+	#define ALLOC1_MAX 251
+#endif
+
+
+typedef struct Alloc1 Alloc1;
+
+struct _packed_ Alloc1
+{
+	uint8_t Next;
+	uint8_t Used;
+	uint8_t Count;
+	uint8_t Free;
+	uint8_t Data[ALLOC1_MAX];
+};
+
+
+typedef struct Alloc1Block Alloc1Block;
+
+struct _packed_ Alloc1Block
+{
+	Alloc1Block* Prev;
+	Alloc1Block* Next;
+	void* RealPtr;
+	uint16_t Count;
+	uint16_t Free;
+	Alloc1 Allocs[];
+};
+
+/* The most `Alloc1`s a block can hold, since they are indexed with `uint8_t`.
+ * Blocks are at least a page big, which is at most 64KiB, so that also limits
+ * them to one page on kernels with big pages.
+ */
+#define ALLOC1_LIMIT_MAX (UINT8_MAX - 2)
+
+static_assert(sizeof(Alloc1Block) + sizeof(Alloc1) * ALLOC1_LIMIT_MAX <= 65536,
+	"Alloc1 size mismatch");
+
+
+#define ALLOC2_MAX UINT16_MAX
+
+typedef struct Alloc2 Alloc2;
+
+struct _packed_ Alloc2
+{
+	Alloc2* Prev;
+	Alloc2* Next;
+	void* RealPtr;
+	uint16_t Used;
+	uint16_t Count;
+	uint16_t Free;
+};
+
+
+#define ALLOC4_MAX UINT32_MAX
+
+/* Free objects of at least this size store a zero tag right after the free
+ * list link. It is set if everything past the tag is known to be zero.
+ */
+#define ALLOC4_ZERO_TAG_MIN 8
+
+typedef struct Alloc4 Alloc4;
+
+struct _packed_ Alloc4
+{
+	Alloc4* Prev;
+	Alloc4* Next;
+	void* RealPtr;
+	uint32_t Used;
+	uint32_t Count;
+	uint32_t Free;
+	/* Blocks differ in size when the handle grows them geometrically.
+	 */
+	uint32_t Limit;
+};
+
+
+/* Bits are set for used objects. The bitmap is made of groups of
+ * `ALLOC_BITMAP_GROUP` words, so that they can be scanned a whole vector at
+ * a time without reading past it. Bits of objects past the end of the block
+ * stay clear, but they are never reached, since the lowest clear bit is taken
+ * and the block is only scanned if it has a free object.
+ */
+#define ALLOC_BITMAP_GROUP 4
+
+typedef struct AllocBitmap AllocBitmap;
+
+struct _packed_ AllocBitmap
+{
+	AllocBitmap* Prev;
+	AllocBitmap* Next;
+	void* RealPtr;
+	uint32_t Used;
+	uint32_t Count;
+	/* The first word of the first group that can have a clear bit.
+	 */
+	uint32_t Hint;
+	uint32_t Limit;
+	uint64_t Bits[];
+};
+
+
+/* Extents are runs of whole pages carved out of a chunk. Every extent has its
+ * number of pages recorded in the map entries of both its first and its last
+ * page, along with whether it is free, so that its neighbors can be found in
+ * constant time. The first page of a free extent links it into a bin of
+ * extents of similar size. Pages from `Used` on have never been handed out.
+ */
+#define ALLOC_EXTENT_FREE (UINT32_C(1) << 31)
+
+/* All pages of a free extent but the first have been given back to the system.
+ */
+#define ALLOC_EXTENT_PURGED (UINT32_C(1) << 30)
+
+#define ALLOC_EXTENT_PAGES (ALLOC_EXTENT_PURGED - 1)
+
+/* 4 bins per power of 2 of pages.
+ */
+#define ALLOC_EXTENT_BINS 128
+
+typedef struct AllocExtent AllocExtent;
+
+struct AllocExtent
+{
+	AllocExtent* Prev;
+	AllocExtent* Next;
+};
+
+typedef struct AllocExtentChunk AllocExtentChunk;
+
+struct _packed_ AllocExtentChunk
+{
+	AllocExtentChunk* Prev;
+	AllocExtentChunk* Next;
+	void* RealPtr;
+	uint32_t Used;
+	uint32_t Count;
+	uint64_t BinMask[ALLOC_EXTENT_BINS / 64];
+	AllocExtent* Bins[ALLOC_EXTENT_BINS];
+	uint32_t Map[];
+};
+
+
+/* Buddy blocks are split in halves, down to objects of the handle's smallest
+ * size. Level `K` holds objects of that size times `2^K`, and has a bit for
+ * each of them that is set while it is free. The bits of all levels follow
+ * each other, the ones of level `K` starting at bit `2N - (2N >> K)`, where
+ * `N` is the number of objects of level `0`. Free objects also link into
+ * a list per level, and `LevelMask` has a bit for each list that is not empty.
+ * The header takes the first objects of the block, which are never free.
+ */
+#define ALLOC_BUDDY_LEVELS 32
+
+typedef struct AllocBuddyFree AllocBuddyFree;
+
+struct AllocBuddyFree
+{
+	AllocBuddyFree* Prev;
+	AllocBuddyFree* Next;
+};
+
+typedef struct AllocBuddy AllocBuddy;
+
+struct _packed_ AllocBuddy
+{
+	AllocBuddy* Prev;
+	AllocBuddy* Next;
+	void* RealPtr;
+	uint32_t Count;
+	uint32_t LevelMask;
+	AllocBuddyFree* Lists[ALLOC_BUDDY_LEVELS];
+	uint64_t Bits[];
+};
+
+
+/* Arena and stack blocks hand out objects by bumping `Used`, the offset of
+ * the first free byte from the header. Blocks are linked newest first, and
+ * only the newest one is ever allocated from. Stacks keep the blocks they
+ * are done with on the `Full` list of the handle, for reuse.
+ */
+typedef struct AllocArena AllocArena;
+
+struct _packed_ AllocArena
+{
+	AllocArena* Prev;
+	AllocArena* Next;
+	void* RealPtr;
+	uint32_t Used;
+};
+
+
+/* `Alloc4` and bitmap handles sort the blocks that they are not allocating
+ * from, and that have free objects, into this many buckets by how full they
+ * are. See `AllocGetBucket`.
+ */
+#define ALLOC_BUCKETS 8
+
+/* The most lists of blocks with free objects a handle has, `Head` and the
+ * lists of `AllocHandleInternal::Levels`. See `AllocGetFreeLists`.
+ */
+#define ALLOC_FREE_LISTS (ALLOC_BUDDY_LEVELS + 1)
+
+
+/* The common beginning of every block header.
+ */
+typedef struct AllocBlock AllocBlock;
+
+struct _packed_ AllocBlock
+{
+	void* Prev;
+	void* Next;
+	void* RealPtr;
+};
+
+
+typedef struct AllocRegion AllocRegion;
+
+
+/* An object with its own virtual memory. `Ptr` is `0` for unused entries.
+ */
+typedef struct AllocVirtualEntry
+{
+	uintptr_t Ptr;
+	alloc_t Size;
+}
+AllocVirtualEntry;
+
+
+typedef struct AllocHandleInternal
+{
+#if ALLOC_THREADS == 1
+	AllocMutex Mutex;
+#endif
+
+	/* Padding for generic allocators (computed from `Alignment`). This is the
+	 * distance from the block header to the first object.
+	 */
+	alloc_t Padding;
+	alloc_t Allocators;
+	alloc_t Allocations;
+	alloc_t AllocLimit;
+	alloc_t AllocSize;
+	alloc_t BlockSize;
+
+	/* Distance from the block header to the start of the block. Non-zero only
+	 * for blocks with out-of-line headers, which live in a separate page that
+	 * directly precedes the block.
+	 */
+	alloc_t HeaderOffset;
+
+	/* Cache coloring. The block header (and with it the first object) is
+	 * offset from the start of the block by `ColorStep` times a number in
+	 * the range `[0, ColorMask]` derived from the block's address. `DataMask`
+	 * pins the first object of out-of-line headers to the start of the block.
+	 */
+	alloc_t ColorMask;
+	alloc_t ColorStep;
+	alloc_t DataMask;
+
+	/* Geometric block growth. The first blocks are carved out of a single
+	 * `BlockSize` aligned spot, the nursery. Its slots are `NurseryMin`
+	 * bytes big at offset `0`, and then `NurseryMin << (N - 1)` bytes big at
+	 * offset `NurseryMin << (N - 1)` for `N >= 1`, so every slot is aligned to
+	 * its own size, and the size of a slot can be deduced from any pointer
+	 * inside it. `NurseryUsed` is a bitmask of mapped slots, and only those
+	 * hold address space. `Nursery` is `0` while none are.
+	 */
+	uintptr_t Nursery;
+	alloc_t NurseryMin;
+	alloc_t NurserySlots;
+	alloc_t NurseryUsed;
+
+	/* The sum of the object limits of all blocks.
+	 */
+	alloc_t Capacity;
+
+	/* Objects are always a whole number of `AllocSize` apart, so their
+	 * indexes are found with an exact division: a shift by the number of
+	 * trailing zeros of `AllocSize`, and a multiplication by the inverse of
+	 * the odd part that remains, modulo `2^32`. Buddy handles only use the
+	 * shift, which is that of their smallest objects.
+	 */
+	uint32_t DivShift;
+	uint32_t DivInverse;
+
+	/* The sum of the sizes of all blocks.
+	 */
+	alloc_t Footprint;
+
+	/* An empty block is only freed if there are still at least this many
+	 * blocks' worth of free objects without it. See `AllocReclaimInfo`.
+	 */
+	alloc_t Spare;
+
+	AllocHandleFlag Flags;
+
+	/* Blocks with free objects, and blocks without any. Allocation only ever
+	 * looks at the former, the latter are there to free everything at once.
+	 */
+	AllocBlock* Head;
+	AllocBlock* Full;
+
+	/* `Alloc4` and bitmap handles only keep the block they allocate from on
+	 * `Head`. Once it fills up, they switch to the fullest block of these,
+	 * so that the emptiest ones get the chance to drain and be freed.
+	 *
+	 * Buddy handles keep nothing on `Head`. Each of their blocks with free
+	 * objects is on the list of the level of its biggest free object, so
+	 * that the first block that fits an object is found without looking at
+	 * any blocks. The `ALLOC_BUDDY_LEVELS` lists are allocated on the side
+	 * along with the first block, so that they do not make every handle
+	 * bigger.
+	 */
+	AllocBlock* Buckets[ALLOC_BUCKETS];
+	AllocBlock** Levels;
+
+	/* An index into `AllocAllocFuncs` and `AllocFreeFuncs`. Function pointers
+	 * would not be valid in other processes that share the handle.
+	 */
+	alloc_t Engine;
+
+	/* The shared memory region that blocks are allocated from, if any.
+	 */
+	AllocRegion* Region;
+
+	/* Objects with their own virtual memory: those of the virtual allocator,
+	 * and those too big for extent chunks. They have no block to be found
+	 * through, so they are kept in an open addressing table keyed by address,
+	 * `VirtualMask + 1` entries big, which is allocated on first use.
+	 */
+	AllocVirtualEntry* Virtual;
+	alloc_t VirtualCount;
+	alloc_t VirtualMask;
+
+	/* What the handle was created with, used for cloning.
+	 */
+	AllocHandleInfo Info;
+}
+AllocHandleInternal;
+
+static_assert(sizeof(AllocHandle) >= sizeof(AllocHandleInternal),
+	"AllocHandle size mismatch");
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -54,7 +54,7 @@ typedef uintptr_t alloc_t;
 	#endif
 
 	#define ALLOC_MUTEX_SIZE	\
-		((sizeof(AllocMutex) + sizeof(alloc_t) - 1) & ~(sizeof(alloc_t) - 1))
+		((sizeof(AllocMutex) + sizeof(alloc_t) - 1) / sizeof(alloc_t))
 #else
 	#define ALLOC_MUTEX_SIZE 0
 #endif
@@ -128,10 +128,12 @@ typedef enum AllocHandleFlag
 	ALLOC_HANDLE_FLAG_NONE					= 0,
 
 	/* By default, one allocator is freed automatically when there is two free
-	 * ones. This flag does not wait for that condition and frees allocators
-	 * as soon as they are empty. This can lead to a weird situation where
-	 * one allocator is full and memory keeps being allocated and deallocated
-	 * in succession, which keeps creating and destroying allocators.
+	 * ones (see `AllocReclaimInfo` for how to change that, and
+	 * `AllocHandleTrimH` for how to free them on demand). This flag does not
+	 * wait for that condition and frees allocators as soon as they are empty.
+	 * This can lead to a weird situation where one allocator is full and
+	 * memory keeps being allocated and deallocated in succession, which keeps
+	 * creating and destroying allocators.
 	 *
 	 * This might be useful when you do not want to cache deallocated memory.
 	 *
@@ -147,6 +149,16 @@ typedef enum AllocHandleFlag
 	 * not, but this flag only becomes noticable with a lot of operations.
 	 */
 	ALLOC_HANDLE_FLAG_DO_NOT_FREE			= 1 << 1,
+
+	/* By default, freed objects keep their contents until they are reused,
+	 * and zeroing allocations of big objects then have to get rid of them.
+	 * With this flag, objects of at least 1MiB have their pages given back
+	 * to the system right when they are freed. They do not count towards
+	 * the memory usage of the process until reused, and zeroing allocations
+	 * that reuse them do not have to clear them again. Non-zeroing
+	 * allocations have to fault the pages back in, though.
+	 */
+	ALLOC_HANDLE_FLAG_PURGE_ON_FREE			= 1 << 2,
 }
 AllocHandleFlag;
 
@@ -164,23 +176,113 @@ AllocHandleFlag;
  * Handles do not have any allocation limit, they are only limited by the total
  * memory available to the process.
  *
- * Note that it is not possible to free all the memory allocated by a handle
- * automatically. You must pair every allocation you ever do with a matching
- * deallocation with the same handle and parameters.
+ * Every allocation must be paired with a matching deallocation with the same
+ * handle and parameters, unless all the objects of the handle are freed at
+ * once with `AllocHandleResetH`.
  *
- * Handles themselves are lightweight - they do not allocate any memory for
- * themselves or require any additional besides this type. What uses memory
- * are the allocators that they hold.
+ * What uses memory are the allocators that a handle holds. The only memory a
+ * handle allocates for itself is the table of its objects with their own
+ * virtual memory (see `AllocHandleResetH`), once it has any, and the lists of
+ * blocks of buddy handles (see `ALLOC_HANDLE_TYPE_BUDDY`).
  */
 typedef struct AllocHandle
 {
 	/* Private. Use getters and setters instead.
 	 */
-	alloc_t Internal[10 + ALLOC_MUTEX_SIZE];
+	alloc_t Internal[42 + ALLOC_MUTEX_SIZE];
 }
 AllocHandle;
 
 
+/* `AllocHandleType` - How a handle keeps track of its objects.
+ */
+typedef enum AllocHandleType
+{
+	/* Free objects are chained into a list stored inside of them.
+	 */
+	ALLOC_HANDLE_TYPE_DEFAULT				= 0,
+
+	/* Every block has a bitmap of its used objects in its header, and new
+	 * objects are taken from the lowest clear bit, found with vector compares
+	 * where available. Freed objects are never written to, objects are reused
+	 * in address order, and the live objects of the handle can be enumerated
+	 * with `AllocHandleWalkH`. The bitmap takes an extra bit per object,
+	 * which for objects of up to 16 bytes is still denser than the default
+	 * for `AllocSize = 1`, and the blocks hold objects of any size in that
+	 * range equally well.
+	 *
+	 * Since there is no room for a zero tag, zeroing allocations always clear
+	 * reused objects, even if `ALLOC_HANDLE_FLAG_PURGE_ON_FREE` already gave
+	 * their pages back.
+	 */
+	ALLOC_HANDLE_TYPE_BITMAP				= 1,
+
+	/* Objects of any size up to `AllocSize` are rounded up to whole pages and
+	 * carved out of chunks of `BlockSize` bytes, with the best fitting free
+	 * run of pages. Freed runs are merged with their free neighbors right
+	 * away. Objects bigger than `AllocSize` come straight from the system,
+	 * like with the virtual allocator. `Alignment`, `CacheColors`, and
+	 * `InitialBlockSize` are ignored, objects are always page aligned.
+	 *
+	 * This is meant for objects too big to share size classes without
+	 * wasting a lot of memory to rounding, but too small to be worth a system
+	 * call each. Free runs keep their pages, except for the first one, until
+	 * the handle is trimmed (see `AllocHandleTrimH`), or right away with
+	 * `ALLOC_HANDLE_FLAG_PURGE_ON_FREE`.
+	 */
+	ALLOC_HANDLE_TYPE_EXTENT				= 2,
+
+	/* Objects of any size up to `AllocSize` are rounded up to a power of two,
+	 * but never below `Alignment`, and split off blocks of `BlockSize` bytes
+	 * by halving bigger free objects. A freed object is merged with its other
+	 * half, and the result with its own, for as long as they are free. Both
+	 * take time logarithmic in the number of sizes. Objects are aligned to
+	 * their rounded size. The header takes the first objects of every block,
+	 * so blocks are made at least twice as big as the biggest objects.
+	 * `CacheColors` and `InitialBlockSize` are ignored.
+	 *
+	 * This is meant for subsystems that want a wide range of sizes from one
+	 * handle and one lock. The rounding wastes up to half of every object
+	 * though, so size classes are denser when they are all well used.
+	 */
+	ALLOC_HANDLE_TYPE_BUDDY					= 3,
+
+	/* Objects of any size up to `AllocSize` are placed one after another in
+	 * blocks of `BlockSize` bytes, each aligned to `Alignment`, and a new
+	 * block is taken when the last one runs out. Freeing an object does
+	 * nothing, the whole handle is freed at once with `AllocArenaResetH` or
+	 * `AllocArenaReleaseH`. `CacheColors` and `InitialBlockSize` are ignored.
+	 *
+	 * This is meant for objects that all die together, like the ones built
+	 * while serving a single request. Allocation costs a few instructions,
+	 * freeing nothing at all, and there is no per object overhead other than
+	 * the alignment. Reallocating an object to a bigger size copies it.
+	 */
+	ALLOC_HANDLE_TYPE_ARENA					= 4,
+
+	/* Same as `ALLOC_HANDLE_TYPE_ARENA`, except that objects are freed in
+	 * the reverse order of allocation. `AllocStackMarkH` saves the current
+	 * position, and `AllocStackRestoreH` frees everything allocated after it
+	 * at once. Freeing the most recent object frees it right away, freeing
+	 * any other object does nothing until the stack is restored past it.
+	 * The most recent object is resized in place while it fits in its block,
+	 * any other one is only shrunk in place. Blocks left empty are kept for
+	 * reuse until the handle is trimmed (see `AllocHandleTrimH`), or freed
+	 * right away with `ALLOC_HANDLE_FLAG_IMMEDIATE_FREE`.
+	 *
+	 * This is meant for scratch memory of recursive code, where every level
+	 * frees what it allocated before returning.
+	 */
+	ALLOC_HANDLE_TYPE_STACK					= 5,
+}
+AllocHandleType;
+
+
+/* Stands for a spare count of `0`, see `Spare` of `AllocHandleInfo`.
+ */
+#define ALLOC_SPARE_NONE ((alloc_t) -1)
+
+
 /* `AllocHandleInfo` - Allocator handle initialization information.
  */
 typedef struct AllocHandleInfo
@@ -196,7 +298,8 @@ typedef struct AllocHandleInfo
 	 * `AllocSize = 2`, that number is `131072`. Anything larger has the limit
 	 * of 1GiB, but you should not set it higher than perhaps some tens of
 	 * megabytes (assuming you will be using gigabytes) to avoid fragmentation.
-	 * If you specify a value larger than the limit, it will be clamped.
+	 * If you specify a value larger than the limit, it will be clamped. Blocks
+	 * are never smaller than a page though (see `AllocGetPageSize`).
 	 *
 	 * The value will automatically be clamped to the bare minimum required so
 	 * that the allocator is able to make at least one allocation. It will also
@@ -215,8 +318,64 @@ typedef struct AllocHandleInfo
 	 *
 	 * `Alignment` is predetermined for `AllocSize = 1` to be `1`, and so in
 	 * that case it is ignored. In other cases, it is theoretically unlimited.
+	 *
+	 * Normally, the block header sits at the beginning of the block and the
+	 * first object is placed right after it, at the nearest aligned address.
+	 * For `AllocSize > 2`, if that would waste at least a page, the header is
+	 * instead stored out of line, in a separate page directly preceding the
+	 * block, and the whole block is used for objects. The block is then at
+	 * least `Alignment` big. This is what makes the largest size classes of
+	 * the global state hold 2 objects per block instead of 1.
 	 */
 	alloc_t Alignment;
+
+	/* The number of cache colors, a power of 2. `0` or `1` disables coloring.
+	 *
+	 * Blocks are aligned to their size, so without coloring, the headers and
+	 * the first objects of all blocks map to the same few cache sets. With
+	 * coloring, every block offsets its header by a multiple of the cache line
+	 * size (or `Alignment`, if bigger) picked from the block's address, and
+	 * the first object moves along with it. Out-of-line headers only move
+	 * within their own page, so the objects are not shifted at all.
+	 *
+	 * This costs up to `CacheColors - 1` steps of space per block. It is
+	 * ignored for `AllocSize = 1`, unless the handle is a bitmap one.
+	 */
+	alloc_t CacheColors;
+
+	/* The size of the first block, or `0` to start at `BlockSize` right away.
+	 *
+	 * If set, the handle starts with a block of this size (rounded up to
+	 * a power of 2 that fits at least one object) and doubles it with every new
+	 * block (the first two are the same size) until it reaches `BlockSize`.
+	 * The growing blocks are all carved out of a single spot of `BlockSize`
+	 * bytes, but only the blocks in use are mapped, so handles that only ever
+	 * hold a few objects only take a few kilobytes of memory and of address
+	 * space. If something else maps the address space right after the last
+	 * block in the meantime, the handle moves on to full blocks early. Once
+	 * an empty block is freed, the next new block reuses the smallest free
+	 * spot.
+	 *
+	 * It is ignored for `AllocSize <= 2`, unless the handle is a bitmap one,
+	 * and for out-of-line headers (see `Alignment`).
+	 */
+	alloc_t InitialBlockSize;
+
+	/* See `AllocHandleType`. `0` is the default.
+	 */
+	AllocHandleType Type;
+
+	/* How many spare blocks the handle keeps, that is how many blocks' worth
+	 * of free objects it must still have after freeing an empty block for
+	 * that block to be freed. `ALLOC_SPARE_NONE` frees every empty block
+	 * right away, bigger values keep that many around for handles that churn.
+	 *
+	 * `0` is the default, which is `1`, and which the reclaim agent adjusts
+	 * (see `AllocReclaimInfo`). Any other value is the handle's own, and the
+	 * agent never changes it. It can be changed later with
+	 * `AllocHandleSetSpareH`.
+	 */
+	alloc_t Spare;
 }
 AllocHandleInfo;
 
@@ -274,19 +433,55 @@ typedef struct AllocStateInfo
 	/* See `AllocIndexFunc` for more information.
 	 */
 	AllocIndexFunc IndexFunc;
+
+	/* If not `0`, the handle that comes after `Handles` and gets all bigger
+	 * sizes is an `ALLOC_HANDLE_TYPE_EXTENT` one, for objects of up to this
+	 * many bytes, instead of the virtual allocator. It is ignored by states
+	 * that live in a region, like `AllocAllocSharedState`.
+	 *
+	 * The default and fine-grained states leave it at `0`. Extents are only
+	 * page aligned, not aligned to the next power of 2 like size classes, and
+	 * their chunks are 256MiB big (16MiB on 32-bit platforms), with twice as
+	 * much address space reserved to align them. Set it for states whose
+	 * biggest classes waste too much memory on rounding, and end `Handles`
+	 * before those classes.
+	 */
+	alloc_t ExtentSizeMax;
 }
 AllocStateInfo;
 
 
+/* Sizes up to this many bytes are looked up in a table instead of going through
+ * the index function, in steps of `1 << ALLOC_SMALL_INDEX_SHIFT` bytes.
+ */
+#define ALLOC_SMALL_INDEX_MAX 1024
+#define ALLOC_SMALL_INDEX_SHIFT 3
+
+/* Marks steps of sizes that do not all share a handle, like `1` to `8` for
+ * the default index function. Those still go through the index function.
+ */
+#define ALLOC_SMALL_INDEX_NONE UINT8_MAX
+
+
 /* `AllocState` - A library state.
  *
  * You can access this structure directly.
  */
 typedef struct AllocState
 {
+	/* `NULL` for the default implementation. That is always the case for
+	 * shared states (see `AllocAllocSharedState`).
+	 */
 	AllocIndexFunc IndexFunc;
 
 	alloc_t HandleCount;
+
+	/* The handle index of every step of small sizes, precomputed with
+	 * `IndexFunc` when the state is created, so that the most common sizes
+	 * cost a single load instead of a call.
+	 */
+	uint8_t SmallIndex[ALLOC_SMALL_INDEX_MAX >> ALLOC_SMALL_INDEX_SHIFT];
+
 	AllocHandle Handles[/*HandleCount*/];
 }
 AllocState;
@@ -304,6 +499,11 @@ AllocGetGlobalState(
 
 
 /* `AllocGetPageSize` - Get the system's page size.
+ *
+ * All block geometry is derived from it at runtime. For testing, the
+ * `ALLOC_PAGE_SIZE` environment variable can make the library act as if the
+ * page size was bigger, for example `16384` or `65536` on a system with 4KiB
+ * pages. It is read once, when the library is loaded.
  */
 extern _const_func_ alloc_t
 AllocGetPageSize(
@@ -491,14 +691,8 @@ AllocCloneHandle(
  * @param `Handle` The handle that you want to destroy. It must have been
  *	created by you using `AllocCreateHandle`.
  *
- * If the handle is not virtual and there have been allocations made with it,
- * there will be one leftover allocator that this function will free. There can
- * however be multiple leftover allocators if you have misused the library. In
- * that case, only one allocator will be freed. Possible causes for that are:
- *
- * 1. You have not properly freed all the memory you allocated.
- *
- * 2. You have used `ALLOC_HANDLE_FLAG_DO_NOT_FREE` where not applicable.
+ * All allocators of the handle are freed, along with the objects that are
+ * still in them (see `AllocHandleResetH`).
  *
  * Every call to `AllocCreateHandle` must be paired with a call to
  * `AllocDestroyHandle`.
@@ -509,6 +703,45 @@ AllocDestroyHandle(
 	);
 
 
+/* `AllocFineIndexFunc` - The index function of fine-grained size classes.
+ *
+ * Sizes up to 8 bytes map to powers of 2, like with the default index
+ * function. Every doubling above that is split into 4 classes, so that
+ * 65 bytes map to the 80 byte class instead of the 128 byte one, and at most
+ * 25% of an object (about 10% on average) is wasted on rounding instead of
+ * 50%. Class `i` of 4 and up is `(5 + i % 4) << (i / 4)` bytes big, rounded
+ * up to a multiple of the biggest power of 2 that fits in it, or of
+ * `_Alignof(max_align_t)` if that is smaller, like `malloc` would align it.
+ * Below 64 bytes that leaves only the 16, 32, 48, and 64 byte classes in use.
+ * It is `O(1)` and branch free past the first 8 sizes.
+ */
+extern uint32_t
+AllocFineIndexFunc(
+	alloc_t Size
+	);
+
+
+/* `AllocGetFineStateInfo` - Get the information of the fine-grained state.
+ *
+ * @return Information to pass to `AllocAllocState` for a state with the same
+ *	range of sizes as the global state, but with the size classes of
+ *	`AllocFineIndexFunc`.
+ *
+ * Objects of such a state are only aligned to the lowest set bit of their
+ * class, not the next power of 2 (a 48 byte object is aligned to 16 bytes).
+ * That is still as much as `malloc` guarantees, see `AllocFineIndexFunc`.
+ * Non power of 2 classes also take a multiplication on every free.
+ *
+ * Define `ALLOC_FINE_SIZE_CLASSES` when building the library to make the global
+ * state use these classes. Shared states (see `AllocAllocSharedState`) cannot
+ * use them, since they require the default index function.
+ */
+extern _const_func_ const AllocStateInfo*
+AllocGetFineStateInfo(
+	void
+	);
+
+
 /* `AllocAllocState` - Allocate a library state.
  *
  * @param `Info` Custom initialization information or `NULL` for the default.
@@ -564,7 +797,8 @@ AllocCloneState(
  *
  * @param `State` A library state returned by `AllocAllocState`.
  *
- * See `AllocDestroyHandle` for more information.
+ * See `AllocDestroyHandle` for more information. Shared states are only
+ * unmapped from the calling process, see `AllocAllocSharedState`.
  *
  * This function is called automatically for the global state unless you define
  * `ALLOC_DO_NOT_AUTO_INIT_GLOBAL_STATE`.
@@ -578,6 +812,391 @@ AllocFreeState(
 	);
 
 
+/* `AllocAllocSharedState` - Create a state that several processes can use.
+ *
+ * @param `Info` Custom initialization information or `NULL` for the default.
+ *	`IndexFunc` must be `NULL`, because a function pointer is not valid in
+ *	other processes, and the state is not created otherwise. Custom handles
+ *	must thus be consecutive powers of 2, or be accessed directly.
+ *
+ * @param `Size` The size of the shared memory region. All memory allocated
+ *	using the state, including the state itself, comes from it. Only the
+ *	memory that is actually used counts towards the memory usage.
+ *
+ * @param `Fd` Receives a file descriptor of the region. Pass it to other
+ *	processes (via `fork`, `SCM_RIGHTS`, or `/proc/<pid>/fd/<fd>`), and have
+ *	them call `AllocAttachSharedState` with it. Close it when no longer
+ *	needed.
+ *
+ * @return The state on success, or `NULL` on failure (lack of memory,
+ *	a custom `IndexFunc`, or the platform does not support shared states,
+ *	which is everything but Linux).
+ *
+ * The region is backed by `memfd_create` and is mapped at the same address in
+ * every process, so pointers to memory allocated from it can be handed over to
+ * other processes as is, no copying involved. They can read the memory and
+ * free it with the same state. Handles of the state lock across processes.
+ * A process that dies while holding a lock leaves the handle locked forever.
+ *
+ * Blocks come straight from the region and do not grow geometrically (see
+ * `AllocHandleInfo`). Virtual handle allocations are rounded up to a power of 2
+ * of address space. Freed memory is given back to the system.
+ *
+ * Every call to `AllocAllocSharedState` must be paired with a call to
+ * `AllocFreeState`, which only unmaps the region from the calling process.
+ */
+extern _alloc_func_ const AllocState*
+AllocAllocSharedState(
+	_in_ AllocStateInfo* Info,
+	alloc_t Size,
+	_out_ int* Fd
+	);
+
+
+/* `AllocAttachSharedState` - Map a shared state into this process.
+ *
+ * @param `Fd` A file descriptor returned by `AllocAllocSharedState`.
+ *
+ * @return The state on success, or `NULL` on failure (the region could not be
+ *	mapped at the address it uses in other processes, or `Fd` is not
+ *	a region).
+ *
+ * The returned pointer is the same as in the process that created the state.
+ * This function does not take ownership of `Fd`. Processes forked after the
+ * state was created already have it mapped and must not attach it again.
+ *
+ * Every call to `AllocAttachSharedState` must be paired with a call to
+ * `AllocFreeState`.
+ */
+extern const AllocState*
+AllocAttachSharedState(
+	int Fd
+	);
+
+
+/* `AllocOpenPersistentState` - Open a state that lives in a file.
+ *
+ * @param `Path` The file. If it does not exist, is empty, or the process that
+ *	created a state in it died before it was done, a new state is created in
+ *	it. Otherwise, the state in it is reattached.
+ *
+ * @param `Info` Same as for `AllocAllocSharedState`. Ignored when reattaching.
+ *
+ * @param `Size` Same as for `AllocAllocSharedState`. Ignored when reattaching.
+ *
+ * @param `Base` The address to map the file at, page aligned, or `NULL` to let
+ *	the library pick one. Ignored when reattaching.
+ *
+ * @return The state on success, or `NULL` on failure (see
+ *	`AllocAllocSharedState` and `AllocAttachSharedState`).
+ *
+ * This is the same as a shared state, except that the region is a file, so
+ * everything allocated from it, along with all of the library's own metadata,
+ * outlives the process. A restarted process gets all of its objects back by
+ * opening the same file, which maps it at the address it was created at.
+ * Objects are not relocated, since they contain raw pointers. Pass a fixed
+ * `Base` when creating the state to make sure the address is free on restart.
+ * Use `AllocSetRootS` to find your data again.
+ *
+ * The file must not be open in another process when it is reattached, since
+ * the locks are reset. If a process dies in the middle of a memory operation,
+ * the state in the file may be inconsistent. Changes are written back to the
+ * file by the system, but only `AllocSyncS` makes sure that they survive
+ * a system crash. Files made by an incompatible version of the library are
+ * not reattached.
+ *
+ * Every call to `AllocOpenPersistentState` must be paired with a call to
+ * `AllocFreeState`, which only unmaps the file.
+ */
+extern _alloc_func_ const AllocState*
+AllocOpenPersistentState(
+	_in_ char* Path,
+	_in_ AllocStateInfo* Info,
+	alloc_t Size,
+	_opaque_ void* Base
+	);
+
+
+/* `AllocAllocRealtimeState` - Create a state that makes no system calls.
+ *
+ * @param `Info` Same as for `AllocAllocSharedState`.
+ *
+ * @param `Size` The size of the memory pool. It is allocated and locked in
+ *	memory right away, so all of it counts towards the memory usage, and it
+ *	is subject to `RLIMIT_MEMLOCK`.
+ *
+ * @return The state on success, or `NULL` on failure (lack of memory, the pool
+ *	could not be locked, or the platform is not Linux).
+ *
+ * After creation, memory operations on the state never call into the system to
+ * map, unmap, protect, or purge memory. Blocks and virtual handle allocations
+ * come from the pool and freed ones are recycled as they are. Once the pool
+ * runs out, allocations fail instead of growing it. The allocation functions
+ * stay `O(1)` otherwise, except that zeroing allocations always clear memory,
+ * and that `AllocSize = 1` blocks are cleared when they are reused.
+ *
+ * Handle locks are still regular mutexes, so contended ones do sleep in the
+ * kernel. Use one state per real-time thread to avoid that.
+ *
+ * Every call to `AllocAllocRealtimeState` must be paired with a call to
+ * `AllocFreeState`.
+ */
+extern _alloc_func_ const AllocState*
+AllocAllocRealtimeState(
+	_in_ AllocStateInfo* Info,
+	alloc_t Size
+	);
+
+
+/* References to objects of compact states are their offsets from the state,
+ * in units of `1 << ALLOC_COMPACT_SHIFT` bytes, so 32 bits cover the whole
+ * region.
+ */
+#define ALLOC_COMPACT_SHIFT 3
+
+/* Smaller objects of compact states are rounded up to this size, so that
+ * references can be made for them.
+ */
+#define ALLOC_COMPACT_SIZE_MIN (UINT32_C(1) << ALLOC_COMPACT_SHIFT)
+
+#define ALLOC_COMPACT_SIZE_MAX (UINT64_C(1) << (32 + ALLOC_COMPACT_SHIFT))
+
+
+/* `AllocAllocCompactState` - Create a state whose objects fit in 32 bits.
+ *
+ * @param `Info` Same as for `AllocAllocSharedState`.
+ *
+ * @param `Size` The size of the region to reserve, at most
+ *	`ALLOC_COMPACT_SIZE_MAX` (32 GiB). Only the pages that are used count
+ *	towards the memory usage.
+ *
+ * @return The state on success, or `NULL` on failure (lack of address space,
+ *	`Size` is too big, or the platform is not Linux).
+ *
+ * Everything allocated from the state lives in one reserved region, so objects
+ * can refer to each other with 32-bit references instead of pointers, halving
+ * the footprint of pointer-heavy data structures. Use `AllocAllocCompactH` and
+ * `AllocFreeCompactH` to allocate and free by reference, and `AllocEncodeRefS`
+ * and `AllocDecodeRefS` (see `alloc_ext.h`) to convert between references and
+ * pointers. Regular pointer-based functions work on the state too.
+ *
+ * References can only be made for objects aligned to
+ * `1 << ALLOC_COMPACT_SHIFT` bytes, which the default handles guarantee for
+ * sizes of at least that much. `AllocAllocCompactS` and `AllocFreeCompactS`
+ * round smaller sizes up to `ALLOC_COMPACT_SIZE_MIN` before they pick
+ * a handle.
+ *
+ * Every call to `AllocAllocCompactState` must be paired with a call to
+ * `AllocFreeState`.
+ */
+extern _alloc_func_ const AllocState*
+AllocAllocCompactState(
+	_in_ AllocStateInfo* Info,
+	alloc_t Size
+	);
+
+
+/* `AllocAllocCompactH` - Allocate an object and return a reference to it.
+ *
+ * @param `Handle` A handle of a state returned by `AllocAllocCompactState`.
+ *
+ * @param `Size` Same as for `AllocAllocH`.
+ *
+ * @param `Zero` Same as for `AllocAllocH`.
+ *
+ * @return The reference to the object, or `0` on failure (lack of memory, or
+ *	the object is not aligned to `1 << ALLOC_COMPACT_SHIFT` bytes, which
+ *	happens for handles of smaller objects).
+ */
+extern uint32_t
+AllocAllocCompactH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Size,
+	int Zero
+	);
+
+
+/* `AllocFreeCompactH` - Free an object allocated with `AllocAllocCompactH`.
+ *
+ * @param `Handle` The handle the object was allocated with.
+ *
+ * @param `Ref` The reference to the object. `0` is ignored.
+ *
+ * @param `Size` Same as for `AllocFreeH`.
+ */
+extern void
+AllocFreeCompactH(
+	_opaque_ AllocHandle* Handle,
+	uint32_t Ref,
+	alloc_t Size
+	);
+
+
+/* The biggest buffer size class of I/O states. Bigger buffers are allocated
+ * as whole chunks of the region.
+ */
+#define ALLOC_IO_SIZE_MAX_SHIFT 20
+
+#define ALLOC_IO_SIZE_MAX (UINT32_C(1) << ALLOC_IO_SIZE_MAX_SHIFT)
+
+
+/* `AllocAllocIoState` - Create a state of page-aligned I/O buffers.
+ *
+ * @param `Size` The size of the region that all buffers are carved out of.
+ *	Only the pages that are used count towards the memory usage.
+ *
+ * @return The state on success, or `NULL` on failure (lack of address space,
+ *	or the platform is not Linux).
+ *
+ * The state has one handle per power of 2 from a page up to
+ * `ALLOC_IO_SIZE_MAX`, and smaller sizes are rounded up to a page. Every buffer
+ * is page aligned, which satisfies `O_DIRECT` on any device, and block headers
+ * live in pages of their own, so data pages hold nothing but buffers.
+ *
+ * Everything lives in a single region, which `AllocGetRangeS` returns. It can
+ * be registered with the kernel once, for example as `io_uring` fixed buffers
+ * with `IORING_REGISTER_BUFFERS`, which takes pieces of at most 1GiB, as
+ * returned by `AllocGetRangePartS`. Every buffer ever allocated from the state
+ * is then a part of that registration. To keep it valid, freed memory is never
+ * given back to the system, so the state only grows until it is freed.
+ * Zeroing allocations always clear memory.
+ *
+ * Freed buffers hold the state's own bookkeeping, a link to the next free
+ * buffer and whether the buffer is known to be zero, in their first few words.
+ * The kernel must be done with a buffer before it is freed, and its contents
+ * are lost once it is.
+ *
+ * Every call to `AllocAllocIoState` must be paired with a call to
+ * `AllocFreeState`.
+ */
+extern _alloc_func_ const AllocState*
+AllocAllocIoState(
+	alloc_t Size
+	);
+
+
+/* `AllocGetRangeS` - Get the memory range that a state allocates from.
+ *
+ * @param `State` Any state.
+ *
+ * @param `Base` Receives the start of the range.
+ *
+ * @param `Size` Receives the size of the range.
+ *
+ * @return `1` if all memory of the state comes from one range, which is the
+ *	case for states returned by `AllocAllocIoState`, `AllocAllocSharedState`,
+ *	`AllocAttachSharedState`, `AllocOpenPersistentState`,
+ *	`AllocAllocRealtimeState`, and `AllocAllocCompactState`. Otherwise `0`,
+ *	and the outputs are left untouched.
+ */
+extern int
+AllocGetRangeS(
+	_in_ AllocState* State,
+	_out_ void** Base,
+	_out_ alloc_t* Size
+	);
+
+
+/* The size of the biggest piece of memory that `io_uring` registers as one
+ * fixed buffer.
+ */
+#define ALLOC_RANGE_PART_SIZE ((alloc_t) 1 << 30)
+
+
+/* `AllocGetRangePartS` - Get a piece of the memory range of a state.
+ *
+ * @param `State` Any state.
+ *
+ * @param `Index` The piece to get, starting at `0`.
+ *
+ * @param `Base` Receives the start of the piece.
+ *
+ * @param `Size` Receives the size of the piece, at most
+ *	`ALLOC_RANGE_PART_SIZE`.
+ *
+ * @return `1` if the piece exists. Otherwise `0`, and the outputs are left
+ *	untouched.
+ *
+ * The range returned by `AllocGetRangeS` is cut at every multiple of
+ * `ALLOC_RANGE_PART_SIZE` in the address space. States carve their memory
+ * out of the range in chunks that are aligned to their own power of 2 size,
+ * so no buffer of at most `ALLOC_RANGE_PART_SIZE` bytes ever straddles two
+ * pieces.
+ */
+extern int
+AllocGetRangePartS(
+	_in_ AllocState* State,
+	alloc_t Index,
+	_out_ void** Base,
+	_out_ alloc_t* Size
+	);
+
+
+/* `AllocGetSyscallCountS` - Count the system calls made for a state.
+ *
+ * @param `State` A state returned by `AllocAllocSharedState`,
+ *	`AllocAttachSharedState`, `AllocOpenPersistentState`, or
+ *	`AllocAllocRealtimeState`. Other states always return `0`.
+ *
+ * @return The number of system calls made for memory operations on the state
+ *	since it was created, by all processes. Always `0` for real-time states,
+ *	unless something is wrong.
+ */
+extern _pure_func_ alloc_t
+AllocGetSyscallCountS(
+	_in_ AllocState* State
+	);
+
+
+/* `AllocSetRootS` - Store a pointer in a shared or persistent state.
+ *
+ * @param `State` A state returned by `AllocAllocSharedState`,
+ *	`AllocAttachSharedState`, or `AllocOpenPersistentState`.
+ *
+ * @param `Root` The pointer, usually to an object allocated from the state.
+ *
+ * The pointer can be retrieved with `AllocGetRootS` by all processes that use
+ * the state, including the ones that reopen a persistent state.
+ */
+extern void
+AllocSetRootS(
+	_in_ AllocState* State,
+	_opaque_ void* Root
+	);
+
+
+/* `AllocGetRootS` - Get the pointer stored with `AllocSetRootS`.
+ *
+ * @param `State` A state returned by `AllocAllocSharedState`,
+ *	`AllocAttachSharedState`, or `AllocOpenPersistentState`.
+ *
+ * @return The pointer, or `NULL` if none has been stored yet.
+ */
+extern _pure_func_ void*
+AllocGetRootS(
+	_in_ AllocState* State
+	);
+
+
+/* `AllocSyncS` - Write a persistent state back to its file.
+ *
+ * @param `State` A state returned by `AllocOpenPersistentState`. Shared and
+ *	other states that live in a region have no file, so it does nothing for
+ *	them, but still succeeds.
+ *
+ * @return `1` on success, or `0` on failure (the state does not live in
+ *	a region, or the file could not be written).
+ *
+ * Returns once everything allocated from the state, along with the library's
+ * metadata, is on disk. Handles are not locked, so objects being changed in
+ * the meantime may be written either way.
+ */
+extern int
+AllocSyncS(
+	_in_ AllocState* State
+	);
+
+
 /* `AllocGetHandleS` - Get an allocator handle given its allocation size.
  *
  * @param `State` A library state returned by `AllocAllocState`.
@@ -732,21 +1351,76 @@ AllocHandleGetFlagsUH(
 	);
 
 
+/* `AllocHandleSetSpareH` - Set how many empty blocks a handle keeps.
+ *
+ * @param `Handle` The handle whose spare count you want to set. It must have
+ *	been created by `AllocCreateHandle` or returned by `AllocGetHandle`.
+ *
+ * @param `Spare` The spare count, `0` for the default. See
+ *	`Spare` of `AllocHandleInfo`.
+ *
+ * Empty blocks that are already kept are not freed right away. Use
+ * `AllocHandleTrimH` for that.
+ */
+extern void
+AllocHandleSetSpareH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Spare
+	);
+
+
+/* See `AllocHandleSetSpareH` and `AllocHandleLockH` for more information.
+ */
+extern void
+AllocHandleSetSpareUH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Spare
+	);
+
+
+/* `AllocHandleGetSpareH` - Get how many empty blocks a handle keeps.
+ *
+ * @param `Handle` The handle whose spare count you want to get. It must have
+ *	been created by `AllocCreateHandle` or returned by `AllocGetHandle`.
+ *
+ * @return The spare count currently in effect, which is the one set for the
+ *	handle, or else the default, as adjusted by the reclaim agent.
+ */
+extern alloc_t
+AllocHandleGetSpareH(
+	_opaque_ AllocHandle* Handle
+	);
+
+
+/* See `AllocHandleGetSpareH` and `AllocHandleLockH` for more information.
+ */
+extern alloc_t
+AllocHandleGetSpareUH(
+	_opaque_ AllocHandle* Handle
+	);
+
+
 /* `AllocAllocH` - Allocate an object.
  *
  * @param `Handle` The handle that will be used to allocate the object.
  *
  * @param `Size` The size of the object.
  *
- * @param `Zero` If non-zero, the object will be zeroed out.
+ * @param `Zero` If non-zero, the first `Size` bytes of the object will be
+ *	zeroed out. Objects that were never handed out before are known to be
+ *	zero and are not touched. Freed objects are only known to be zero once
+ *	their pages were given back, by `ALLOC_HANDLE_FLAG_PURGE_ON_FREE`,
+ *	`AllocHandleTrimH` or the reclaim agent. Other big objects are zeroed by
+ *	dropping their pages rather than writing them.
  *
  * @return The pointer to the allocated object.
  *
  * The output pointer is guaranteed to be aligned to the handle's alignment.
  * See `AllocHandleInfo` for more information.
  *
- * For all handles except virtual ones, `Size` must be less than or equal to
- * the handle's allocation size. For virtual handles, there is no such limit.
+ * For all handles except virtual and `ALLOC_HANDLE_TYPE_EXTENT` ones, `Size`
+ * must be less than or equal to the handle's allocation size. For those,
+ * there is no such limit.
  */
 extern _alloc_func_ void*
 AllocAllocH(
@@ -837,6 +1511,338 @@ AllocReallocUH(
 	);
 
 
+/* `AllocHandleTrimH` - Give cached memory of a handle back to the system.
+ *
+ * @param `Handle` The handle.
+ *
+ * @param `Target` The footprint to trim the handle down to, in bytes. `0`
+ *	releases everything that can be released.
+ *
+ * @return The number of bytes given back to the system.
+ *
+ * The footprint of a handle is the total size of its blocks. Empty blocks are
+ * freed until the footprint is at most `Target`. If that is not enough, free
+ * objects of at least 1MiB have their pages given back to the system too,
+ * which is counted as released even though their blocks stay. Blocks of
+ * states that keep freed memory to themselves, like `AllocAllocRealtimeState`
+ * and `AllocAllocIoState`, shrink the footprint, but are not counted.
+ *
+ * Handles normally keep some empty blocks around to absorb the next burst of
+ * allocations (see `AllocReclaimInfo`). This lets the caller shed them at
+ * a time of its choosing, such as right after a garbage collection cycle.
+ * Objects that are in use are never touched. Handles of the virtual allocator
+ * have no cache, so they always return `0`.
+ */
+extern alloc_t
+AllocHandleTrimH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Target
+	);
+
+
+/* See `AllocHandleTrimH` and `AllocHandleLockH` for more information.
+ */
+extern alloc_t
+AllocHandleTrimUH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Target
+	);
+
+
+/* `AllocHandleResetH` - Free every object of a handle at once.
+ *
+ * @param `Handle` The handle.
+ *
+ * Every allocator of the handle is freed in one pass, full ones included, so
+ * the cost depends on the number of allocators, not objects. All pointers to
+ * objects of the handle become invalid. The handle itself stays usable.
+ *
+ * Objects with their own virtual memory, which are those of the virtual
+ * allocator and those too big for `ALLOC_HANDLE_TYPE_EXTENT` chunks, are
+ * tracked in a table on the side, and are unmapped one by one, along with the
+ * table. The cost of that grows with their number.
+ */
+extern void
+AllocHandleResetH(
+	_opaque_ AllocHandle* Handle
+	);
+
+
+/* See `AllocHandleResetH` and `AllocHandleLockH` for more information.
+ */
+extern void
+AllocHandleResetUH(
+	_opaque_ AllocHandle* Handle
+	);
+
+
+/* `AllocWalkFunc` - Callback receiving a live object of a handle.
+ *
+ * @param `Ptr` The object.
+ *
+ * @param `Context` Whatever was passed to `AllocHandleWalkH`.
+ */
+typedef void
+(*AllocWalkFunc)(
+	void* Ptr,
+	void* Context
+	);
+
+
+/* `AllocHandleWalkH` - Call a function for every live object of a handle.
+ *
+ * @param `Handle` A handle of `ALLOC_HANDLE_TYPE_BITMAP`.
+ *
+ * @param `Func` The function to call.
+ *
+ * @param `Context` Passed to `Func` as is.
+ *
+ * Objects are visited block by block, in address order within each block.
+ * Every word of a block's bitmap covers 64 objects, so long runs of free
+ * objects are skipped quickly. This can be used to gather statistics, or to
+ * move the live objects out of sparse blocks.
+ *
+ * `Func` must not allocate from or free to the handle.
+ */
+extern void
+AllocHandleWalkH(
+	_opaque_ AllocHandle* Handle,
+	AllocWalkFunc Func,
+	void* Context
+	);
+
+
+/* See `AllocHandleWalkH` and `AllocHandleLockH` for more information.
+ */
+extern void
+AllocHandleWalkUH(
+	_opaque_ AllocHandle* Handle,
+	AllocWalkFunc Func,
+	void* Context
+	);
+
+
+/* `AllocArenaResetH` - Free every object of an arena, but keep a block.
+ *
+ * @param `Handle` A handle of `ALLOC_HANDLE_TYPE_ARENA`.
+ *
+ * All blocks but the first one the arena took are freed, and allocation
+ * starts over at the beginning of that one. Its pages stay mapped, so an
+ * arena that is reset after every request does not fault them back in, and
+ * does not make any system calls if the request fits the block. All pointers
+ * to objects of the handle become invalid.
+ */
+extern void
+AllocArenaResetH(
+	_opaque_ AllocHandle* Handle
+	);
+
+
+/* See `AllocArenaResetH` and `AllocHandleLockH` for more information.
+ */
+extern void
+AllocArenaResetUH(
+	_opaque_ AllocHandle* Handle
+	);
+
+
+/* `AllocArenaReleaseH` - Free every object and every block of an arena.
+ *
+ * @param `Handle` A handle of `ALLOC_HANDLE_TYPE_ARENA`.
+ *
+ * Same as `AllocArenaResetH`, but the first block is freed as well. Same as
+ * `AllocHandleResetH` too. The next allocation takes a new block.
+ */
+extern void
+AllocArenaReleaseH(
+	_opaque_ AllocHandle* Handle
+	);
+
+
+/* See `AllocArenaReleaseH` and `AllocHandleLockH` for more information.
+ */
+extern void
+AllocArenaReleaseUH(
+	_opaque_ AllocHandle* Handle
+	);
+
+
+/* `AllocStackMarkH` - Save the position of a stack.
+ *
+ * @param `Handle` A handle of `ALLOC_HANDLE_TYPE_STACK`.
+ *
+ * @return A mark to pass to `AllocStackRestoreH`. It is only valid until the
+ * stack is restored to an earlier mark, the object right before it is freed,
+ * or the stack is reset.
+ */
+extern alloc_t
+AllocStackMarkH(
+	_opaque_ AllocHandle* Handle
+	);
+
+
+/* See `AllocStackMarkH` and `AllocHandleLockH` for more information.
+ */
+extern _pure_func_ alloc_t
+AllocStackMarkUH(
+	_opaque_ AllocHandle* Handle
+	);
+
+
+/* `AllocStackRestoreH` - Free everything allocated after a mark.
+ *
+ * @param `Handle` A handle of `ALLOC_HANDLE_TYPE_STACK`.
+ *
+ * @param `Mark` A mark returned by `AllocStackMarkH`.
+ *
+ * The cost depends on the number of blocks taken since the mark, not on the
+ * number of objects. All pointers to objects allocated after the mark become
+ * invalid, and so do all marks taken after it. The mark itself stays valid.
+ */
+extern void
+AllocStackRestoreH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Mark
+	);
+
+
+/* See `AllocStackRestoreH` and `AllocHandleLockH` for more information.
+ */
+extern void
+AllocStackRestoreUH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Mark
+	);
+
+
+/* `AllocResetState` - Free every object of a state at once.
+ *
+ * @param `State` The state, or `NULL` for the global state.
+ *
+ * Calls `AllocHandleResetH` on all handles of the state, which makes it
+ * possible to throw away a state used for a single request or task in one go.
+ */
+extern void
+AllocResetState(
+	_in_opt_ AllocState* State
+	);
+
+
+/* `AllocTrimState` - Give cached memory of a state back to the system.
+ *
+ * @param `State` The state, or `NULL` for the global state.
+ *
+ * @param `Target` The total footprint of all of the state's handles to trim
+ *	down to, in bytes.
+ *
+ * @return The number of bytes given back to the system.
+ *
+ * Handles are trimmed one at a time with `AllocHandleTrimH`, the ones with
+ * the biggest objects first, until the footprint is down to `Target`.
+ */
+extern alloc_t
+AllocTrimState(
+	_in_opt_ AllocState* State,
+	alloc_t Target
+	);
+
+
+/* `AllocReclaimInfo` - Reclaim agent initialization information.
+ *
+ * An empty block is normally only freed if its handle still has a block's
+ * worth of free objects without it, so that a handle that keeps allocating and
+ * freeing around a block boundary does not keep creating and destroying
+ * blocks. That number of blocks is called spare. The reclaim agent raises it
+ * while there is no memory pressure and drops it to 0, which frees every empty
+ * block, while there is. Handles with a spare count of their own (see `Spare`
+ * of `AllocHandleInfo`) keep it.
+ * When the pressure starts, it also frees all the empty blocks that were kept,
+ * and gives the pages of free objects of at least 1MiB back to the system.
+ *
+ * All fields can be `0` for the defaults.
+ */
+typedef struct AllocReclaimInfo
+{
+	/* The file to poll. Either a PSI file, in which case the `some avg10`
+	 * value is compared against `Threshold`, or a cgroup's `memory.events`,
+	 * in which case a growing `high` or `max` counter means pressure. The
+	 * default is `/proc/pressure/memory`. Any file with the same format will
+	 * do, which is useful for testing.
+	 */
+	const char* Path;
+
+	/* How often to poll the file, in milliseconds. The default is `1000`.
+	 */
+	uint32_t Interval;
+
+	/* The PSI pressure threshold, in hundredths of a percent of time stalled.
+	 * The default is `1000` (10%).
+	 */
+	uint32_t Threshold;
+
+	/* The spare count while there is no pressure, `ALLOC_SPARE_NONE` for
+	 * none. The default is `3`.
+	 */
+	alloc_t Spare;
+}
+AllocReclaimInfo;
+
+
+/* `AllocStartReclaimAgent` - Start the reclaim agent.
+ *
+ * @param `Info` Custom initialization information or `NULL` for the default.
+ *
+ * @return `1` on success, or `0` on failure (the agent is already running,
+ *	or the platform does not support it, which is Windows and single threaded
+ *	builds).
+ *
+ * The agent is a thread that polls a memory pressure file and adjusts all
+ * registered states (see `AllocRegisterState`) accordingly. See
+ * `AllocReclaimInfo` for more information.
+ *
+ * Every call to `AllocStartReclaimAgent` must be paired with a call to
+ * `AllocStopReclaimAgent`, which restores the default spare count.
+ */
+extern int
+AllocStartReclaimAgent(
+	_in_opt_ AllocReclaimInfo* Info
+	);
+
+
+/* See `AllocStartReclaimAgent` for more information.
+ */
+extern void
+AllocStopReclaimAgent(
+	void
+	);
+
+
+/* `AllocRegisterState` - Let the reclaim agent manage a state.
+ *
+ * @param `State` The state, or `NULL` for the global state.
+ *
+ * @return `1` on success, or `0` on failure (too many states, see
+ *	`ALLOC_RECLAIM_MAX_STATES`, or the agent is not supported).
+ *
+ * No state is registered by default, not even the global one, so the agent
+ * only ever touches the states that it is given. `AllocFreeState` unregisters
+ * states automatically.
+ */
+extern int
+AllocRegisterState(
+	_in_opt_ AllocState* State
+	);
+
+
+/* See `AllocRegisterState` for more information. Once this returns, the agent
+ * is done with the state, even if it was in the middle of going through it.
+ */
+extern void
+AllocUnregisterState(
+	_in_opt_ AllocState* State
+	);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,32 +18,45 @@
 extern "C" {
 #endif
 
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+
 #include "../include/alloc_std.h"
+#include "../include/alloc_internal.h"
 #include "../include/debug.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
-#ifndef _packed_
-	#define _packed_ __attribute__((packed))
+#if defined(__AVX2__) || defined(__SSE2__)
+	#include <immintrin.h>
 #endif
 
 #define ALLOC_IS_POWER_OF_2(X) (((X) & ((X) - 1)) == 0)
 
+#ifndef ALLOC_CACHE_LINE_SIZE
+	#define ALLOC_CACHE_LINE_SIZE 64
+#endif
+
 #define ALLOC_ARRAYLEN(X) (sizeof(X) / sizeof(*(X)))
 
-#define ALLOC_MIN(X, Y)		\
-({							\
-	__typeof__(X) _X = (X);	\
-	__typeof__(Y) _Y = (Y);	\
-	_X < _Y ? _X : _Y;		\
+/* Both operands are converted to their common type first, so that a plain
+ * constant can be compared against an `alloc_t` without a sign mismatch.
+ */
+#define ALLOC_MIN(X, Y)				\
+({									\
+	__typeof__((X) + (Y)) _X = (X);	\
+	__typeof__((X) + (Y)) _Y = (Y);	\
+	_X < _Y ? _X : _Y;				\
 })
 
-#define ALLOC_MAX(X, Y)		\
-({							\
-	__typeof__(X) _X = (X);	\
-	__typeof__(Y) _Y = (Y);	\
-	_X > _Y ? _X : _Y;		\
+#define ALLOC_MAX(X, Y)				\
+({									\
+	__typeof__((X) + (Y)) _X = (X);	\
+	__typeof__((X) + (Y)) _Y = (Y);	\
+	_X > _Y ? _X : _Y;				\
 })
 
 #define ALLOC_ALIGN(Ptr, Mask) ((void*)(((alloc_t) (Ptr) + (Mask)) & ~(Mask)))
@@ -85,10 +98,15 @@ extern "C" {
 	}
 
 
-	_alloc_func_ void*
-	AllocAllocVirtualAligned(
+	/* Same as `AllocAllocVirtualAligned`, but additionally commits `Prefix`
+	 * bytes right before the aligned memory. `*Ptr` points to the start of
+	 * the prefix. Free with `Size + Prefix` as the size.
+	 */
+	Static void*
+	AllocAllocVirtualAlignedPrefix(
 		alloc_t Size,
 		alloc_t Alignment,
+		alloc_t Prefix,
 		_out_ void** Ptr
 		)
 	{
@@ -102,7 +120,7 @@ extern "C" {
 		}
 
 		alloc_t Mask = Alignment - 1;
-		alloc_t ActualSize = Size + Mask;
+		alloc_t ActualSize = Prefix + Size + Mask;
 
 		void* RealPtr = VirtualAlloc(NULL,
 			ActualSize, MEM_RESERVE, PAGE_NOACCESS);
@@ -111,10 +129,11 @@ extern "C" {
 			return NULL;
 		}
 
-		void* AlignedPtr = ALLOC_ALIGN(RealPtr, Mask);
+		void* AlignedPtr = (uint8_t*) ALLOC_ALIGN(
+			(uint8_t*) RealPtr + Prefix, Mask) - Prefix;
 
 		void* CommittedPtr = VirtualAlloc(
-			AlignedPtr, Size, MEM_COMMIT, PAGE_READWRITE);
+			AlignedPtr, Prefix + Size, MEM_COMMIT, PAGE_READWRITE);
 		if(!CommittedPtr)
 		{
 			AllocFreeVirtual(RealPtr, ActualSize);
@@ -126,6 +145,17 @@ extern "C" {
 	}
 
 
+	_alloc_func_ void*
+	AllocAllocVirtualAligned(
+		alloc_t Size,
+		alloc_t Alignment,
+		_out_ void** Ptr
+		)
+	{
+		return AllocAllocVirtualAlignedPrefix(Size, Alignment, 0, Ptr);
+	}
+
+
 	void
 	AllocFreeVirtualAligned(
 		_opaque_ void* Ptr,
@@ -137,9 +167,85 @@ extern "C" {
 	}
 
 
+	/* Reserves address space without committing any memory to it.
+	 */
+	Static void*
+	AllocReserveVirtualAligned(
+		alloc_t Size,
+		alloc_t Alignment,
+		_out_ void** Ptr
+		)
+	{
+		alloc_t ActualSize = Size + Alignment - 1;
+
+		void* RealPtr = VirtualAlloc(NULL,
+			ActualSize, MEM_RESERVE, PAGE_NOACCESS);
+		if(!RealPtr)
+		{
+			return NULL;
+		}
+
+		*Ptr = ALLOC_ALIGN(RealPtr, Alignment - 1);
+		return RealPtr;
+	}
+
+
+	/* Commits memory at exactly `Ptr`, but only if none of it is taken yet.
+	 * Free with `AllocFreeVirtual`.
+	 */
+	Static int
+	AllocAllocVirtualAt(
+		void* Ptr,
+		alloc_t Size
+		)
+	{
+		void* NewPtr = VirtualAlloc(Ptr, Size,
+			MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if(NewPtr != Ptr)
+		{
+			AllocFreeVirtual(NewPtr, Size);
+			return 0;
+		}
+
+		return 1;
+	}
+
+
+	/* Gives the memory back to the system. Committing it again yields zeros.
+	 */
+	Static void
+	AllocDecommitVirtual(
+		void* Ptr,
+		alloc_t Size
+		)
+	{
+		BOOL Status = VirtualFree(Ptr, Size, MEM_DECOMMIT);
+		AssertNEQ(Status, 0);
+	}
+
+
+	/* Drops the contents of committed memory. Reading it again yields zeros.
+	 */
+	Static void
+	AllocPurgeVirtual(
+		void* Ptr,
+		alloc_t Size
+		)
+	{
+		AllocDecommitVirtual(Ptr, Size);
+
+		void* NewPtr = VirtualAlloc(Ptr, Size, MEM_COMMIT, PAGE_READWRITE);
+		AssertEQ(NewPtr, Ptr);
+	}
+
+
 #else
 	#include <sys/mman.h>
 
+	#ifndef MAP_FIXED_NOREPLACE
+		#define MAP_FIXED_NOREPLACE 0
+	#endif
+
 
 	_alloc_func_ void*
 	AllocAllocVirtual(
@@ -178,10 +284,15 @@ extern "C" {
 	}
 
 
-	_alloc_func_ void*
-	AllocAllocVirtualAligned(
+	/* Same as `AllocAllocVirtualAligned`, but additionally commits `Prefix`
+	 * bytes right before the aligned memory. `*Ptr` points to the start of
+	 * the prefix. Free with `Size + Prefix` as the size.
+	 */
+	Static void*
+	AllocAllocVirtualAlignedPrefix(
 		alloc_t Size,
 		alloc_t Alignment,
+		alloc_t Prefix,
 		_out_ void** Ptr
 		)
 	{
@@ -195,7 +306,7 @@ extern "C" {
 		}
 
 		alloc_t Mask = Alignment - 1;
-		alloc_t ActualSize = Size + Mask;
+		alloc_t ActualSize = Prefix + Size + Mask;
 
 		void* RealPtr = mmap(NULL, ActualSize, PROT_NONE,
 			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
@@ -204,9 +315,10 @@ extern "C" {
 			return NULL;
 		}
 
-		void* AlignedPtr = ALLOC_ALIGN(RealPtr, Mask);
+		void* AlignedPtr = (uint8_t*) ALLOC_ALIGN(
+			(uint8_t*) RealPtr + Prefix, Mask) - Prefix;
 
-		if(mprotect(AlignedPtr, Size, PROT_READ | PROT_WRITE))
+		if(mprotect(AlignedPtr, Prefix + Size, PROT_READ | PROT_WRITE))
 		{
 			AllocFreeVirtual(RealPtr, ActualSize);
 			return NULL;
@@ -217,6 +329,17 @@ extern "C" {
 	}
 
 
+	_alloc_func_ void*
+	AllocAllocVirtualAligned(
+		alloc_t Size,
+		alloc_t Alignment,
+		_out_ void** Ptr
+		)
+	{
+		return AllocAllocVirtualAlignedPrefix(Size, Alignment, 0, Ptr);
+	}
+
+
 	void
 	AllocFreeVirtualAligned(
 		_opaque_ void* RealPtr,
@@ -228,7 +351,91 @@ extern "C" {
 	}
 
 
+	/* Reserves address space without committing any memory to it.
+	 */
+	Static void*
+	AllocReserveVirtualAligned(
+		alloc_t Size,
+		alloc_t Alignment,
+		_out_ void** Ptr
+		)
+	{
+		alloc_t ActualSize = Size + Alignment - 1;
+
+		void* RealPtr = mmap(NULL, ActualSize, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(RealPtr == MAP_FAILED)
+		{
+			return NULL;
+		}
+
+		*Ptr = ALLOC_ALIGN(RealPtr, Alignment - 1);
+		return RealPtr;
+	}
+
+
+	/* Commits memory at exactly `Ptr`, but only if none of it is taken yet.
+	 * Kernels without `MAP_FIXED_NOREPLACE` take the address as a hint, so
+	 * the result is checked either way. Free with `AllocFreeVirtual`.
+	 */
+	Static int
+	AllocAllocVirtualAt(
+		void* Ptr,
+		alloc_t Size
+		)
+	{
+		void* NewPtr = mmap(Ptr, Size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+		if(NewPtr == MAP_FAILED)
+		{
+			return 0;
+		}
+
+		if(NewPtr != Ptr)
+		{
+			AllocFreeVirtual(NewPtr, Size);
+			return 0;
+		}
+
+		return 1;
+	}
+
+
+	/* Drops the contents of committed memory. Reading it again yields zeros.
+	 */
+	Static void
+	AllocPurgeVirtual(
+		void* Ptr,
+		alloc_t Size
+		)
+	{
+		int Status = madvise(Ptr, Size, MADV_DONTNEED);
+		AssertEQ(Status, 0);
+	}
+
+
+	#ifdef __linux__
+		/* Same as `AllocPurgeVirtual`, but for shared memory, which
+		 * `MADV_DONTNEED` would only unmap from this process.
+		 */
+		Static void
+		AllocPurgeShared(
+			void* Ptr,
+			alloc_t Size
+			)
+		{
+			int Status = madvise(Ptr, Size, MADV_REMOVE);
+			AssertEQ(Status, 0);
+		}
+	#endif
+
+
 	#include <unistd.h>
+
+	#ifdef __linux__
+		#include <fcntl.h>
+		#include <sys/stat.h>
+	#endif
 #endif
 
 
@@ -358,6 +565,32 @@ AllocReallocVirtualAligned(
 		}
 
 
+		#ifdef __linux__
+			/* For mutexes that live in memory shared between processes.
+			 */
+			Static void
+			AllocMutexInitShared(
+				AllocMutex* Mutex
+				)
+			{
+				pthread_mutexattr_t Attr;
+
+				int Status = pthread_mutexattr_init(&Attr);
+				AssertEQ(Status, 0);
+
+				Status = pthread_mutexattr_setpshared(&Attr,
+					PTHREAD_PROCESS_SHARED);
+				AssertEQ(Status, 0);
+
+				Status = pthread_mutex_init(Mutex, &Attr);
+				AssertEQ(Status, 0);
+
+				Status = pthread_mutexattr_destroy(&Attr);
+				AssertEQ(Status, 0);
+			}
+		#endif
+
+
 		Static void
 		AllocMutexDestroy(
 			AllocMutex* Mutex
@@ -404,75 +637,14 @@ AllocReallocVirtualAligned(
 
 
 
-#if __SIZEOF_POINTER__ == 8
-	#define ALLOC1_MAX 250
-#else
-	#define ALLOC1_MAX 251
+/* Zeroing at least this many bytes is done by dropping the pages instead of
+ * writing to them. Must be at least 2 pages.
+ */
+#ifndef ALLOC_PURGE_ZERO_MIN
+	#define ALLOC_PURGE_ZERO_MIN (UINT32_C(1) << 20)
 #endif
 
 
-typedef struct _packed_ Alloc1 Alloc1;
-
-struct _packed_ Alloc1
-{
-	uint8_t Next;
-	uint8_t Used;
-	uint8_t Count;
-	uint8_t Free;
-	uint8_t Data[ALLOC1_MAX];
-};
-
-
-typedef struct Alloc1Block Alloc1Block;
-
-struct _packed_ Alloc1Block
-{
-	Alloc1Block* Prev;
-	Alloc1Block* Next;
-	void* RealPtr;
-	uint16_t Count;
-	uint16_t Free;
-	Alloc1 Allocs[];
-};
-
-/* Optimized for the most common page size and default block size */
-static_assert(sizeof(Alloc1Block) + sizeof(Alloc1) * 16 <= 4096,
-	"Alloc1 size mismatch");
-
-
-#define ALLOC2_MAX UINT16_MAX
-
-typedef struct Alloc2 Alloc2;
-
-struct _packed_ Alloc2
-{
-	Alloc2* Prev;
-	Alloc2* Next;
-	void* RealPtr;
-	uint16_t Used;
-	uint16_t Count;
-	uint16_t Free;
-};
-
-
-#define ALLOC4_MAX UINT32_MAX
-
-typedef struct Alloc4 Alloc4;
-
-struct _packed_ Alloc4
-{
-	Alloc4* Prev;
-	Alloc4* Next;
-	void* RealPtr;
-	uint32_t Used;
-	uint32_t Count;
-	uint32_t Free;
-};
-
-
-typedef struct AllocHandleInternal AllocHandleInternal;
-
-
 typedef void*
 (*AllocAllocFunc)(
 	AllocHandleInternal* Handle,
@@ -490,165 +662,195 @@ typedef void
 	);
 
 
-typedef struct AllocHandleInternal
+/* The header of a memory region (a memfd, a file, or private memory), at the
+ * very beginning of it. Every process maps the region at `Base`, so pointers
+ * into it stay valid in all of them, and across restarts. `Version` and
+ * `Layout` guard against reattaching a region made by an incompatible build.
+ * `Magic` is written last, so a region whose creation was cut short still
+ * reads as zero there. `Root` is the user's. Blocks are naturally aligned
+ * power of 2 chunks carved from `Used` onwards. Freed chunks are purged, so
+ * that they read as zero again, and kept in `Free`, one list per size, linked
+ * through their first word.
+ */
+struct AllocRegion
 {
+	uint64_t Magic;
+	uint32_t Version;
+	alloc_t Layout;
+	uintptr_t Base;
+	alloc_t Size;
+	alloc_t Used;
+	uintptr_t Free[sizeof(alloc_t) * 8];
+	const AllocState* State;
+	void* Root;
+	alloc_t Flags;
+
+	/* The number of system calls made on behalf of the region after it was
+	 * created.
+	 */
+	alloc_t Syscalls;
+
 #if ALLOC_THREADS == 1
 	AllocMutex Mutex;
 #endif
+};
 
-	/* Padding for generic allocators (computed from `Alignment`).
-	 */
-	alloc_t Padding;
-	alloc_t Allocators;
-	alloc_t Allocations;
-	alloc_t AllocLimit;
-	alloc_t AllocSize;
-	alloc_t BlockSize;
+/* Freed chunks are recycled as they are, without purging them, so they are
+ * dirty: block headers are cleared when reused, and objects are cleared on
+ * zeroing allocations even when they come from untouched parts of a block.
+ * Pages, once touched, stay with the region.
+ */
+#define ALLOC_REGION_FLAG_DIRTY 1
 
-	AllocHandleFlag Flags;
+/* The region is private anonymous memory, which `MADV_REMOVE` does not work on.
+ */
+#define ALLOC_REGION_FLAG_PRIVATE 2
 
-	struct
-	{
-		void* Prev;
-		void* Next;
-		void* RealPtr;
-	}
-	*Head;
+/* The region is at most `ALLOC_COMPACT_SIZE_MAX` bytes long, so that objects
+ * in it can be referred to with 32-bit references.
+ */
+#define ALLOC_REGION_FLAG_COMPACT 4
+
+/* The region is locked in memory right away. Along with
+ * `ALLOC_REGION_FLAG_DIRTY`, no system calls are made for it after creation.
+ */
+#define ALLOC_REGION_FLAG_LOCKED 8
+
+/* Bump this whenever anything stored in a region changes its meaning. The
+ * layout only catches changes of the sizes of the structures.
+ */
+#define ALLOC_REGION_VERSION 2
+
+#define ALLOC_REGION_LAYOUT ((sizeof(AllocState) << 24) ^	\
+	(sizeof(AllocRegion) << 12) ^ sizeof(AllocHandle))
+
+#define ALLOC_REGION_MAGIC UINT64_C(0x6E6F696765527341)
+
+/* Regions are aligned to this, so that the first few big chunks do not leave
+ * gaps behind.
+ */
+#define ALLOC_REGION_ALIGNMENT (UINT32_C(1) << 21)
 
-	AllocAllocFunc AllocFunc;
-	AllocFreeFunc FreeFunc;
-}
-AllocHandleInternal;
 
-static_assert(sizeof(AllocHandle) >= sizeof(AllocHandleInternal),
-	"AllocHandle size mismatch");
 
 
 #define ALLOC_PO2(X) (UINT32_C(1) << UINT32_C(X))
 #define ALLOC_DEFAULT_BLOCK_SIZE ALLOC_PO2(23)
+#define ALLOC_DEFAULT_INITIAL_BLOCK_SIZE ALLOC_PO2(16)
+
+/* The chunk size of the extent handle of states that ask for one, see
+ * `AllocStateInfo`. Chunks are aligned to their size, which reserves twice as
+ * much address space as they hold, too much for 32-bit address spaces.
+ */
+#if UINTPTR_MAX > UINT32_MAX
+	#define ALLOC_DEFAULT_EXTENT_BLOCK_SIZE ALLOC_PO2(28)
+#else
+	#define ALLOC_DEFAULT_EXTENT_BLOCK_SIZE ALLOC_PO2(24)
+#endif
+
+#define ALLOC_DEFAULT_HANDLE_INFO(X)						\
+{															\
+	.AllocSize = ALLOC_PO2(X),								\
+	.BlockSize = ALLOC_DEFAULT_BLOCK_SIZE,					\
+	.Alignment = ALLOC_PO2(X),								\
+	.InitialBlockSize = ALLOC_DEFAULT_INITIAL_BLOCK_SIZE	\
+}
 
 Static AllocHandleInfo AllocDefaultHandleInfo[] =
 (AllocHandleInfo[])
 {
 	/* The defaults. For `Alloc1` the minimum size is set so that it gets
-	 * clamped to the page size. For the rest 8MiB is set (clamped to at most
-	 * `131072` for `Alloc2`). That is a reasonable tradeoff between memory
-	 * fragmentation and performance. You can edit the macro above to suit you.
-	 * Do not edit the code below.
+	 * clamped to the page size, whatever it is at runtime. For the rest 8MiB
+	 * is set (clamped to at most `131072` for `Alloc2`), starting from 64KiB
+	 * and growing geometrically. That is a reasonable tradeoff between memory
+	 * fragmentation and performance. You can edit the macros above to suit
+	 * you. Do not edit the code below.
 	 */
 /*   0*/{ .AllocSize = 1, .BlockSize =
 			sizeof(Alloc1Block) + sizeof(Alloc1), .Alignment = 1 },
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(2)
-/*   1*/{ .AllocSize = ALLOC_PO2(1), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(1) },
+/*   1*/ALLOC_DEFAULT_HANDLE_INFO(1),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(3)
-/*   2*/{ .AllocSize = ALLOC_PO2(2), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(2)},
+/*   2*/ALLOC_DEFAULT_HANDLE_INFO(2),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(4)
-/*   3*/{ .AllocSize = ALLOC_PO2(3), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(3)},
+/*   3*/ALLOC_DEFAULT_HANDLE_INFO(3),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(5)
-/*   4*/{ .AllocSize = ALLOC_PO2(4), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(4)},
+/*   4*/ALLOC_DEFAULT_HANDLE_INFO(4),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(6)
-/*   5*/{ .AllocSize = ALLOC_PO2(5), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(5)},
+/*   5*/ALLOC_DEFAULT_HANDLE_INFO(5),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(7)
-/*   6*/{ .AllocSize = ALLOC_PO2(6), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(6)},
+/*   6*/ALLOC_DEFAULT_HANDLE_INFO(6),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(8)
-/*   7*/{ .AllocSize = ALLOC_PO2(7), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(7)},
+/*   7*/ALLOC_DEFAULT_HANDLE_INFO(7),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(9)
-/*   8*/{ .AllocSize = ALLOC_PO2(8), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(8)},
+/*   8*/ALLOC_DEFAULT_HANDLE_INFO(8),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(10)
-/*   9*/{ .AllocSize = ALLOC_PO2(9), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(9)},
+/*   9*/ALLOC_DEFAULT_HANDLE_INFO(9),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(11)
-/*  10*/{ .AllocSize = ALLOC_PO2(10), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(10)},
+/*  10*/ALLOC_DEFAULT_HANDLE_INFO(10),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(12)
-/*  11*/{ .AllocSize = ALLOC_PO2(11), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(11)},
+/*  11*/ALLOC_DEFAULT_HANDLE_INFO(11),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(13)
-/*  12*/{ .AllocSize = ALLOC_PO2(12), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(12)},
+/*  12*/ALLOC_DEFAULT_HANDLE_INFO(12),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(14)
-/*  13*/{ .AllocSize = ALLOC_PO2(13), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(13)},
+/*  13*/ALLOC_DEFAULT_HANDLE_INFO(13),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(15)
-/*  14*/{ .AllocSize = ALLOC_PO2(14), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(14)},
+/*  14*/ALLOC_DEFAULT_HANDLE_INFO(14),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(16)
-/*  15*/{ .AllocSize = ALLOC_PO2(15), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(15)},
+/*  15*/ALLOC_DEFAULT_HANDLE_INFO(15),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(17)
-/*  16*/{ .AllocSize = ALLOC_PO2(16), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(16)},
+/*  16*/ALLOC_DEFAULT_HANDLE_INFO(16),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(18)
-/*  17*/{ .AllocSize = ALLOC_PO2(17), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(17)},
+/*  17*/ALLOC_DEFAULT_HANDLE_INFO(17),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(19)
-/*  18*/{ .AllocSize = ALLOC_PO2(18), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(18)},
+/*  18*/ALLOC_DEFAULT_HANDLE_INFO(18),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(20)
-/*  19*/{ .AllocSize = ALLOC_PO2(19), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(19)},
+/*  19*/ALLOC_DEFAULT_HANDLE_INFO(19),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(21)
-/*  20*/{ .AllocSize = ALLOC_PO2(20), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(20)},
+/*  20*/ALLOC_DEFAULT_HANDLE_INFO(20),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(22)
-/*  21*/{ .AllocSize = ALLOC_PO2(21), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(21)},
+/*  21*/ALLOC_DEFAULT_HANDLE_INFO(21),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(23)
-/*  22*/{ .AllocSize = ALLOC_PO2(22), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(22)},
+/*  22*/ALLOC_DEFAULT_HANDLE_INFO(22),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(24)
-/*  23*/{ .AllocSize = ALLOC_PO2(23), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(23)},
+/*  23*/ALLOC_DEFAULT_HANDLE_INFO(23),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(25)
-/*  24*/{ .AllocSize = ALLOC_PO2(24), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(24)},
+/*  24*/ALLOC_DEFAULT_HANDLE_INFO(24),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(26)
-/*  25*/{ .AllocSize = ALLOC_PO2(25), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(25)},
+/*  25*/ALLOC_DEFAULT_HANDLE_INFO(25),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(27)
-/*  26*/{ .AllocSize = ALLOC_PO2(26), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(26)},
+/*  26*/ALLOC_DEFAULT_HANDLE_INFO(26),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(28)
-/*  27*/{ .AllocSize = ALLOC_PO2(27), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(27)},
+/*  27*/ALLOC_DEFAULT_HANDLE_INFO(27),
 #endif
 #if ALLOC_DEFAULT_BLOCK_SIZE >= ALLOC_PO2(29)
-/*  28*/{ .AllocSize = ALLOC_PO2(28), .BlockSize =
-			ALLOC_DEFAULT_BLOCK_SIZE, .Alignment = ALLOC_PO2(28)},
+/*  28*/ALLOC_DEFAULT_HANDLE_INFO(28),
 #endif
 };
 
@@ -657,10 +859,31 @@ Static AllocStateInfo AllocDefaultStateInfo =
 {
 	.Handles = AllocDefaultHandleInfo,
 	.HandleCount = ALLOC_ARRAYLEN(AllocDefaultHandleInfo),
-	.IndexFunc = NULL
+	.IndexFunc = NULL,
+	.ExtentSizeMax = 0
+};
+
+
+/* The same range of sizes as the defaults, but with 4 classes per doubling
+ * above 8 bytes, see `AllocFineIndexFunc`. Filled in at startup.
+ */
+Static AllocHandleInfo
+	AllocFineHandleInfo[4 * (ALLOC_ARRAYLEN(AllocDefaultHandleInfo) - 3)];
+
+Static AllocStateInfo AllocFineStateInfo =
+(AllocStateInfo)
+{
+	.Handles = AllocFineHandleInfo,
+	.HandleCount = ALLOC_ARRAYLEN(AllocFineHandleInfo),
+	.IndexFunc = AllocFineIndexFunc,
+	.ExtentSizeMax = 0
 };
 
 
+/* What handles start with, see `AllocReclaimInfo`.
+ */
+#define ALLOC_DEFAULT_SPARE 1
+
 Static alloc_t AllocPageSize;
 Static alloc_t AllocPageSizeMask;
 Static uint32_t AllocPageSizeShift;
@@ -684,6 +907,17 @@ AllocLog2(
 }
 
 
+Static uint32_t
+AllocLog2Floor(
+	alloc_t Value
+	)
+{
+	AssertNEQ(Value, 0);
+
+	return 63 - __builtin_clzll(Value);
+}
+
+
 Static uint32_t
 AllocGetNextPO2(
 	alloc_t Value
@@ -700,6 +934,67 @@ AllocGetNextPO2(
 }
 
 
+/* Rounds `Size` up to a multiple of the alignment that `malloc` guarantees
+ * for it, which is the biggest power of 2 that fits in it, up to that of
+ * `max_align_t`.
+ */
+Static alloc_t
+AllocFineRoundSize(
+	alloc_t Size
+	)
+{
+	alloc_t Alignment = ALLOC_MIN((alloc_t) 1 << AllocLog2Floor(Size),
+		(alloc_t) _Alignof(max_align_t));
+
+	return (Size + Alignment - 1) & ~(Alignment - 1);
+}
+
+
+/* Turns a spare count given by the user, other than `0`, into the one the free
+ * paths compare against.
+ */
+Static alloc_t
+AllocResolveSpare(
+	alloc_t Spare
+	)
+{
+	return Spare != ALLOC_SPARE_NONE ? Spare : 0;
+}
+
+
+/* Class `i` of 4 and up is `(5 + i % 4) << (i / 4)` bytes big, rounded by
+ * `AllocFineRoundSize`. Objects are only aligned to the lowest set bit of
+ * their size.
+ */
+Static void
+AllocInitFineHandleInfo(
+	void
+	)
+{
+	for(alloc_t i = 0; i < ALLOC_ARRAYLEN(AllocFineHandleInfo); ++i)
+	{
+		if(i < 4)
+		{
+			AllocFineHandleInfo[i] = AllocDefaultHandleInfo[i];
+			continue;
+		}
+
+		/* Classes that round up to the next one are never picked by
+		 * `AllocFineIndexFunc`, so their handles stay empty.
+		 */
+		alloc_t Size = AllocFineRoundSize((5 + i % 4) << (i / 4));
+
+		AllocFineHandleInfo[i] = (AllocHandleInfo)
+		{
+			.AllocSize = Size,
+			.BlockSize = ALLOC_DEFAULT_BLOCK_SIZE,
+			.Alignment = Size & -Size,
+			.InitialBlockSize = ALLOC_DEFAULT_INITIAL_BLOCK_SIZE
+		};
+	}
+}
+
+
 Static __attribute__((constructor)) void
 AllocLibraryInit(
 	void
@@ -716,11 +1011,31 @@ AllocLibraryInit(
 	AssertNEQ(AllocPageSize, 0);
 	AssertEQ(ALLOC_IS_POWER_OF_2(AllocPageSize), 1);
 
+	/* Lets tests simulate kernels with bigger pages. Everything works in
+	 * multiples of the page size, so the real pages still line up.
+	 */
+	const char* PageSizeOverride = getenv("ALLOC_PAGE_SIZE");
+	if(PageSizeOverride)
+	{
+		alloc_t PageSize = strtoull(PageSizeOverride, NULL, 0);
+
+		if(PageSize > AllocPageSize && ALLOC_IS_POWER_OF_2(PageSize))
+		{
+			AllocPageSize = PageSize;
+		}
+	}
+
 	AllocPageSizeMask = AllocPageSize - 1;
 	AllocPageSizeShift = AllocLog2(AllocPageSize);
 
+	AllocInitFineHandleInfo();
+
 #ifndef ALLOC_DO_NOT_AUTO_INIT_GLOBAL_STATE
-	AllocGlobalState = AllocAllocState(NULL);
+	#ifdef ALLOC_FINE_SIZE_CLASSES
+		AllocGlobalState = AllocAllocState(&AllocFineStateInfo);
+	#else
+		AllocGlobalState = AllocAllocState(NULL);
+	#endif
 	AssertNEQ(AllocGlobalState, NULL);
 #endif
 }
@@ -731,6 +1046,8 @@ AllocLibraryDestroy(
 	void
 	)
 {
+	AllocStopReclaimAgent();
+
 #ifndef ALLOC_DO_NOT_AUTO_INIT_GLOBAL_STATE
 	AllocFreeState(AllocGlobalState);
 #endif
@@ -764,743 +1081,4800 @@ AllocGetDefaultBlockSize(
 }
 
 
+#ifdef __linux__
+
+
+/* Maps `Size` bytes of `Fd` at an address aligned to `Alignment`. A negative
+ * `Fd` maps private anonymous memory instead.
+ */
 Static void*
-AllocAlloc1Func(
-	AllocHandleInternal* Handle,
+AllocMapRegion(
+	int Fd,
 	alloc_t Size,
-	int Zero
+	alloc_t Alignment
 	)
 {
-	(void) Size;
+	void* Ptr;
 
-	Alloc1Block* Block = (void*) Handle->Head;
-	if(!Block)
+	void* RealPtr = AllocReserveVirtualAligned(Size, Alignment, &Ptr);
+	if(!RealPtr)
 	{
-		void* RealPtr = AllocAllocVirtualAligned(
-			Handle->BlockSize, Handle->BlockSize, (void**) &Block);
-		if(!RealPtr)
-		{
-			return NULL;
-		}
+		return NULL;
+	}
 
-		/*
-		Block->Prev = NULL;
-		Block->Next = NULL;
-		*/
-		Block->RealPtr = RealPtr;
-		/*
-		Block->Count = 0;
-		Block->Free = 0;
-		*/
+	void* NewPtr = mmap(Ptr, Size, PROT_READ | PROT_WRITE, MAP_FIXED |
+		(Fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE : MAP_SHARED),
+		Fd, 0);
+	if(NewPtr == MAP_FAILED)
+	{
+		AllocFreeVirtual(RealPtr, Size + Alignment - 1);
+		return NULL;
+	}
 
-		alloc_t i = 0;
-		Alloc1* Alloc = Block->Allocs;
+	uint8_t* End = (uint8_t*) Ptr + Size;
+	uint8_t* RealEnd = (uint8_t*) RealPtr + Size + Alignment - 1;
 
-		for(; i < Handle->AllocLimit - 1; ++i, ++Alloc)
-		{
-			Alloc->Next = i + 1;
-			/*
-			Alloc->Used = 0;
-			Alloc->Count = 0;
-			*/
-			Alloc->Free = UINT8_MAX;
-		}
+	if(Ptr != RealPtr)
+	{
+		AllocFreeVirtual(RealPtr, (uint8_t*) Ptr - (uint8_t*) RealPtr);
+	}
 
-		Alloc->Next = UINT8_MAX;
-		/*
-		Alloc->Used = 0;
-		Alloc->Count = 0;
-		*/
-		Alloc->Free = UINT8_MAX;
+	if(End != RealEnd)
+	{
+		AllocFreeVirtual(End, RealEnd - End);
+	}
 
-		++Handle->Allocators;
-		Handle->Head = (void*) Block;
+	return Ptr;
+}
+
+
+/* Rounds `Size` up to the size of the chunk that holds it.
+ */
+Static alloc_t
+AllocRegionGetChunkSize(
+	alloc_t Size
+	)
+{
+	if(Size <= AllocPageSize)
+	{
+		return AllocPageSize;
 	}
 
-	Alloc1* Alloc = &Block->Allocs[Block->Free];
+	return (alloc_t) 1 << (AllocLog2Floor(Size - 1) + 1);
+}
 
-	++Handle->Allocations;
-	++Block->Count;
-	++Alloc->Count;
 
-	if(Alloc->Count == ALLOC1_MAX)
+Static void
+AllocRegionPushChunk(
+	AllocRegion* Region,
+	uintptr_t Chunk,
+	alloc_t Size
+	)
+{
+	uint32_t Order = AllocLog2(Size);
+
+	*(uintptr_t*) Chunk = Region->Free[Order];
+	Region->Free[Order] = Chunk;
+}
+
+
+/* Returns a zeroed chunk of `Size` bytes aligned to `Size`, which must be
+ * a power of 2 of at least a page.
+ */
+Static void*
+AllocRegionAlloc(
+	AllocRegion* Region,
+	alloc_t Size
+	)
+{
+#if ALLOC_THREADS == 1
+	ALLOC_LOCK(&Region->Mutex);
+#endif
+
+	uint32_t Order = AllocLog2(Size);
+	uintptr_t Chunk = Region->Free[Order];
+
+	if(Chunk)
 	{
-		if(Block->Count == ALLOC1_MAX * Handle->AllocLimit)
-		{
-			Handle->Head = (void*) Block->Next;
+		Region->Free[Order] = *(uintptr_t*) Chunk;
+		*(uintptr_t*) Chunk = 0;
+	}
+	else
+	{
+		uintptr_t Start = Region->Base + Region->Used;
+		uintptr_t End = Region->Base + Region->Size;
+		uintptr_t Aligned = (uintptr_t) ALLOC_ALIGN(Start, Size - 1);
 
-			if(Block->Next)
+		if(Aligned < End && End - Aligned >= Size)
+		{
+			/* The gap is cut into the biggest aligned chunks that fit.
+			 */
+			while(Start < Aligned)
 			{
-				Block->Next->Prev = NULL;
+				alloc_t Piece = Start & -Start;
+
+				while(Start + Piece > Aligned)
+				{
+					Piece >>= 1;
+				}
+
+				AllocRegionPushChunk(Region, Start, Piece);
+				Start += Piece;
 			}
 
-			Block->Prev = NULL;
-			Block->Next = NULL;
-		}
-		else
-		{
-			Block->Free = Alloc->Next;
+			Region->Used = Aligned + Size - Region->Base;
+			Chunk = Aligned;
 		}
 	}
 
-	if(Alloc->Free != UINT8_MAX)
-	{
-		uint8_t* Ptr = Alloc->Data + Alloc->Free;
-		Alloc->Free = *Ptr;
+#if ALLOC_THREADS == 1
+	ALLOC_UNLOCK(&Region->Mutex);
+#endif
 
-		if(Zero)
-		{
-			*Ptr = 0;
-		}
+	return (void*) Chunk;
+}
 
-		return Ptr;
+
+Static void
+AllocRegionPurge(
+	AllocRegion* Region,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+	if(Region->Flags & ALLOC_REGION_FLAG_PRIVATE)
+	{
+		AllocPurgeVirtual(Ptr, Size);
+	}
+	else
+	{
+		AllocPurgeShared(Ptr, Size);
 	}
 
-	return Alloc->Data + Alloc->Used++;
+	__atomic_add_fetch(&Region->Syscalls, 1, __ATOMIC_RELAXED);
 }
 
 
 Static void
-AllocFree1Func(
-	AllocHandleInternal* Handle,
-	void* BlockPtr,
-	void* Ptr,
+AllocRegionFree(
+	AllocRegion* Region,
+	void* Chunk,
 	alloc_t Size
 	)
 {
-	(void) Size;
+	if(!(Region->Flags & ALLOC_REGION_FLAG_DIRTY))
+	{
+		AllocRegionPurge(Region, Chunk, Size);
+	}
 
-	Alloc1Block* Block = BlockPtr;
-	Alloc1* Alloc = &Block->Allocs[
-		((uintptr_t) Ptr - (uintptr_t) Block - sizeof(Alloc1Block))
-		/ sizeof(Alloc1)];
+#if ALLOC_THREADS == 1
+	ALLOC_LOCK(&Region->Mutex);
+#endif
 
-	--Handle->Allocations;
-	--Block->Count;
-	--Alloc->Count;
+	AllocRegionPushChunk(Region, (uintptr_t) Chunk, Size);
 
-	if(
-		Block->Count == 0 &&
-		(
-			(Handle->Flags & ALLOC_HANDLE_FLAG_IMMEDIATE_FREE) ||
-			(
-				Handle->Allocators >= 2 &&
-				!(Handle->Flags & ALLOC_HANDLE_FLAG_DO_NOT_FREE) &&
-				Handle->Allocations <= ALLOC1_MAX *
-					Handle->AllocLimit * (Handle->Allocators - 2)
-			)
-		)
-		)
+#if ALLOC_THREADS == 1
+	ALLOC_UNLOCK(&Region->Mutex);
+#endif
+}
+
+
+#endif /* __linux__ */
+
+
+Static alloc_t
+AllocGetBlockColor(
+	AllocHandleInternal* Handle,
+	uintptr_t Base
+	)
+{
+	/* Blocks are allocated at more or less random addresses, so hashing the
+	 * address spreads the colors just as well as a counter would, while not
+	 * needing to be stored anywhere.
+	 */
+	uint32_t Hash = (uint32_t) (Base >> AllocPageSizeShift) *
+		UINT32_C(2654435761);
+
+	return ((Hash >> 16) & Handle->ColorMask) * Handle->ColorStep;
+}
+
+
+/* Returns the start of the block that contains `Ptr`.
+ */
+Static uintptr_t
+AllocGetBlockBase(
+	AllocHandleInternal* Handle,
+	_in_ void* Ptr
+	)
+{
+	uintptr_t Base = (uintptr_t) Ptr & ~(Handle->BlockSize - 1);
+
+	if(Base == Handle->Nursery)
 	{
-		if(Block->Prev)
-		{
-			Block->Prev->Next = Block->Next;
-		}
-		else
-		{
-			Handle->Head = (void*) Block->Next;
-		}
+		alloc_t Offset = (uintptr_t) Ptr - Base;
 
-		if(Block->Next)
+		if(Offset >= Handle->NurseryMin)
 		{
-			Block->Next->Prev = Block->Prev;
+			Base += (alloc_t) 1 << (AllocLog2Floor(Offset));
 		}
+	}
 
-		AllocFreeVirtualAligned(Block->RealPtr,
-			Handle->BlockSize, Handle->BlockSize);
+	return Base;
+}
 
-		--Handle->Allocators;
+
+Static void*
+AllocGetBlockHeader(
+	AllocHandleInternal* Handle,
+	uintptr_t Base
+	)
+{
+	return (void*) (Base - Handle->HeaderOffset +
+		AllocGetBlockColor(Handle, Base));
+}
+
+
+Static uint8_t*
+AllocGetBlockData(
+	AllocHandleInternal* Handle,
+	void* Block
+	)
+{
+	return (uint8_t*) (((uintptr_t) Block + Handle->Padding) &
+		Handle->DataMask);
+}
+
+
+/* Maps the lowest free nursery slot, picking a spot for the nursery if none
+ * of it is mapped. Returns `0` if the nursery is full, if something else took
+ * the address space of the slot since, or if the system is out of memory.
+ */
+Static uintptr_t
+AllocAllocNurserySlot(
+	AllocHandleInternal* Handle,
+	_out_ alloc_t* Size
+	)
+{
+	alloc_t Slot = __builtin_ctzll(~(uint64_t) Handle->NurseryUsed);
+	if(Slot >= Handle->NurserySlots)
+	{
+		return 0;
 	}
-	else
+
+	uintptr_t Nursery = Handle->Nursery;
+
+	if(!Handle->NurseryUsed)
 	{
-		if(Alloc->Count == ALLOC1_MAX - 1)
+		/* Only the address is kept. The slots are mapped one by one later,
+		 * so that the address space of the ones not in use is not held.
+		 */
+		void* Ptr;
+
+		void* RealPtr = AllocReserveVirtualAligned(
+			Handle->BlockSize, Handle->BlockSize, &Ptr);
+		if(!RealPtr)
 		{
-			Alloc->Next = Block->Free;
-			Block->Free = Alloc - Block->Allocs;
+			return 0;
+		}
 
-			if(Block->Count == ALLOC1_MAX * Handle->AllocLimit - 1)
-			{
-				if(Handle->Head)
-				{
-					Handle->Head->Prev = Block;
-				}
+		AllocFreeVirtual(RealPtr, (Handle->BlockSize << 1) - 1);
 
-				AssertEQ(Block->Prev, NULL);
-				Block->Next = (void*) Handle->Head;
-				Handle->Head = (void*) Block;
-			}
-		}
+		Nursery = (uintptr_t) Ptr;
+	}
 
+	alloc_t Offset = Slot ? Handle->NurseryMin << (Slot - 1) : 0;
+	*Size = Slot ? Offset : Handle->NurseryMin;
 
-		*((uint8_t*) Ptr) = Alloc->Free;
-		Alloc->Free = (uint8_t*) Ptr - Alloc->Data;
+	uintptr_t Base = Nursery + Offset;
+
+	if(!AllocAllocVirtualAt((void*) Base, *Size))
+	{
+		return 0;
 	}
+
+	Handle->Nursery = Nursery;
+	Handle->NurseryUsed |= (alloc_t) 1 << Slot;
+
+	return Base;
 }
 
 
-Static void*
-AllocAlloc2Func(
+/* Returns the size of the slot.
+ */
+Static alloc_t
+AllocFreeNurserySlot(
 	AllocHandleInternal* Handle,
-	alloc_t Size,
-	int Zero
+	uintptr_t Base
 	)
 {
-	(void) Size;
+	alloc_t Offset = Base - Handle->Nursery;
+	alloc_t Slot = Offset ? AllocLog2(Offset / Handle->NurseryMin) + 1 : 0;
+	alloc_t Size = Offset ? Offset : Handle->NurseryMin;
 
-	Alloc2* Alloc = (void*) Handle->Head;
-	if(!Alloc)
+	AllocFreeVirtual((void*) Base, Size);
+
+	/* Once nothing is mapped there, a full block could take the spot, and
+	 * must not be mistaken for a nursery one.
+	 */
+	Handle->NurseryUsed &= ~((alloc_t) 1 << Slot);
+	if(!Handle->NurseryUsed)
 	{
-		void* RealPtr = AllocAllocVirtualAligned(
-			Handle->BlockSize, Handle->BlockSize, (void**) &Alloc);
-		if(!RealPtr)
+		Handle->Nursery = 0;
+	}
+
+	return Size;
+}
+
+
+/* Whether new blocks and chunks of the handle can hold garbage.
+ */
+Static int
+AllocHandleIsDirty(
+	AllocHandleInternal* Handle
+	)
+{
+	return Handle->Region &&
+		(Handle->Region->Flags & ALLOC_REGION_FLAG_DIRTY);
+}
+
+
+/* Allocates a new block and returns its header with `RealPtr` set. `Size`
+ * receives the size of the block, which is only ever less than `BlockSize` for
+ * nursery blocks. Those have a `NULL` `RealPtr`.
+ */
+Static AllocBlock*
+AllocAllocBlock(
+	AllocHandleInternal* Handle,
+	_out_ alloc_t* Size
+	)
+{
+#ifdef __linux__
+	if(Handle->Region)
+	{
+		/* The header page of out-of-line headers is at the end of the first
+		 * half of the chunk. It is the only page of that half that is touched.
+		 */
+		alloc_t ChunkSize = AllocRegionGetChunkSize(
+			Handle->BlockSize + Handle->HeaderOffset);
+
+		uint8_t* Chunk = AllocRegionAlloc(Handle->Region, ChunkSize);
+		if(!Chunk)
 		{
 			return NULL;
 		}
 
-		Alloc->RealPtr = RealPtr;
-		Alloc->Free = ALLOC2_MAX;
+		AllocBlock* Block = AllocGetBlockHeader(Handle,
+			(uintptr_t) Chunk + ChunkSize - Handle->BlockSize);
 
-		++Handle->Allocators;
-		Handle->Head = (void*) Alloc;
-	}
+		/* The engines expect zeroed headers. `Alloc1` has them all over.
+		 */
+		if(AllocHandleIsDirty(Handle))
+		{
+			alloc_t HeaderSize =
+				Handle->Engine == 1 ? Handle->BlockSize :
+				Handle->Engine == 2 ? sizeof(Alloc2) :
+				Handle->Engine == 3 ? sizeof(Alloc4) :
+				Handle->Engine == 5 ? sizeof(AllocExtentChunk) :
+				Handle->Padding;
+
+			(void) memset(Block, 0, HeaderSize);
+		}
 
-	++Handle->Allocations;
-	++Alloc->Count;
+		Block->RealPtr = Chunk;
 
-	uint8_t* Data = (uint8_t*) Alloc + Handle->Padding;
+		*Size = Handle->BlockSize;
+		Handle->Footprint += *Size;
 
-	if(Alloc->Count == Handle->AllocLimit)
-	{
-		Handle->Head = (void*) Alloc->Next;
+		return Block;
+	}
+#endif
 
-		if(Alloc->Next)
+	if(Handle->NurserySlots)
+	{
+		uintptr_t Base = AllocAllocNurserySlot(Handle, Size);
+		if(Base)
 		{
-			Alloc->Next->Prev = NULL;
-		}
+			AllocBlock* Block = AllocGetBlockHeader(Handle, Base);
+			Block->RealPtr = NULL;
 
-		Alloc->Next = NULL;
+			Handle->Footprint += *Size;
+
+			return Block;
+		}
 	}
 
-	if(Alloc->Free != ALLOC2_MAX)
+	void* Ptr;
+
+	void* RealPtr = AllocAllocVirtualAlignedPrefix(Handle->BlockSize,
+		Handle->BlockSize, Handle->HeaderOffset, &Ptr);
+	if(!RealPtr)
 	{
-		void* Ptr = Data + Alloc->Free * 2;
+		return NULL;
+	}
 
-		(void) memcpy(&Alloc->Free, Ptr, 2);
+	AllocBlock* Block = AllocGetBlockHeader(Handle,
+		(uintptr_t) Ptr + Handle->HeaderOffset);
+	Block->RealPtr = RealPtr;
+
+	*Size = Handle->BlockSize;
+	Handle->Footprint += *Size;
+
+	return Block;
+}
+
+
+/* Returns the number of bytes given back to the system, which is the size of
+ * the block, unless it goes back to a region that keeps its memory dirty.
+ */
+Static alloc_t
+AllocFreeBlock(
+	AllocHandleInternal* Handle,
+	AllocBlock* Block
+	)
+{
+	if(!Block->RealPtr)
+	{
+		alloc_t Size = AllocFreeNurserySlot(Handle,
+			AllocGetBlockBase(Handle, Block));
+		Handle->Footprint -= Size;
+
+		return Size;
+	}
+
+	Handle->Footprint -= Handle->BlockSize;
+
+#ifdef __linux__
+	if(Handle->Region)
+	{
+		AllocRegionFree(Handle->Region, Block->RealPtr,
+			AllocRegionGetChunkSize(Handle->BlockSize + Handle->HeaderOffset));
+		return AllocHandleIsDirty(Handle) ? 0 : Handle->BlockSize;
+	}
+#endif
+
+	AllocFreeVirtualAligned(Block->RealPtr,
+		Handle->BlockSize + Handle->HeaderOffset, Handle->BlockSize);
+
+	return Handle->BlockSize;
+}
+
+
+Static void
+AllocPushBlock(
+	AllocBlock** List,
+	void* BlockPtr
+	)
+{
+	AllocBlock* Block = BlockPtr;
+
+	if(*List)
+	{
+		(*List)->Prev = Block;
+	}
+
+	Block->Prev = NULL;
+	Block->Next = *List;
+	*List = Block;
+}
+
+
+Static void
+AllocUnlinkBlock(
+	AllocBlock** List,
+	void* BlockPtr
+	)
+{
+	AllocBlock* Block = BlockPtr;
+
+	if(Block->Prev)
+	{
+		((AllocBlock*) Block->Prev)->Next = Block->Next;
+	}
+	else
+	{
+		*List = Block->Next;
+	}
+
+	if(Block->Next)
+	{
+		((AllocBlock*) Block->Next)->Prev = Block->Prev;
+	}
+}
+
+
+/* Blocks are bucketed by how many times more objects than free objects they
+ * have, rounded down to a power of 2. Bucket `0` holds the emptiest blocks,
+ * the last one the fullest. A block only moves to another bucket when its
+ * number of free objects reaches a power of 2.
+ */
+Static alloc_t
+AllocGetBucket(
+	alloc_t Limit,
+	alloc_t Free
+	)
+{
+	alloc_t Bucket = AllocLog2Floor(Limit) - AllocLog2Floor(Free);
+
+	return ALLOC_MIN(Bucket, (alloc_t) ALLOC_BUCKETS - 1);
+}
+
+
+/* Makes the fullest bucketed block the one to allocate from. Returns `NULL`
+ * if there is none.
+ */
+Static AllocBlock*
+AllocTakeFullestBlock(
+	AllocHandleInternal* Handle
+	)
+{
+	for(alloc_t i = ALLOC_BUCKETS; i-- > 0;)
+	{
+		AllocBlock* Block = Handle->Buckets[i];
+
+		if(Block)
+		{
+			AllocUnlinkBlock(&Handle->Buckets[i], Block);
+			AllocPushBlock(&Handle->Head, Block);
+
+			return Block;
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Moves a block that has just had an object freed, and now has `Count` of
+ * them, to the list it belongs to. Returns that list.
+ */
+Static AllocBlock**
+AllocRebucketBlock(
+	AllocHandleInternal* Handle,
+	void* Block,
+	alloc_t Count,
+	alloc_t Limit
+	)
+{
+	if(Block == Handle->Head)
+	{
+		return &Handle->Head;
+	}
+
+	alloc_t Free = Limit - Count;
+	alloc_t Bucket = AllocGetBucket(Limit, Free);
+
+	if(Free == 1)
+	{
+		AllocUnlinkBlock(&Handle->Full, Block);
+		AllocPushBlock(&Handle->Buckets[Bucket], Block);
+	}
+	else
+	{
+		alloc_t OldBucket = AllocGetBucket(Limit, Free - 1);
+
+		if(OldBucket != Bucket)
+		{
+			AllocUnlinkBlock(&Handle->Buckets[OldBucket], Block);
+			AllocPushBlock(&Handle->Buckets[Bucket], Block);
+		}
+	}
+
+	return &Handle->Buckets[Bucket];
+}
+
+
+/* The lists of blocks with free objects, that is `Head`, and the buckets, or
+ * the levels of buddy handles. Returns how many there are.
+ */
+Static alloc_t
+AllocGetFreeLists(
+	AllocHandleInternal* Handle,
+	AllocBlock** Lists[ALLOC_FREE_LISTS]
+	)
+{
+	Lists[0] = &Handle->Head;
+
+	if(Handle->Engine == 6)
+	{
+		if(!Handle->Levels)
+		{
+			return 1;
+		}
+
+		for(alloc_t i = 0; i < ALLOC_BUDDY_LEVELS; ++i)
+		{
+			Lists[i + 1] = &Handle->Levels[i];
+		}
+
+		return ALLOC_BUDDY_LEVELS + 1;
+	}
+
+	for(alloc_t i = 0; i < ALLOC_BUCKETS; ++i)
+	{
+		Lists[i + 1] = &Handle->Buckets[i];
+	}
+
+	return ALLOC_BUCKETS + 1;
+}
+
+
+/* Gives whole pages back to the system. They read as zero afterwards.
+ */
+Static void
+AllocPurgeMemory(
+	AllocHandleInternal* Handle,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+#ifdef __linux__
+	if(Handle->Region)
+	{
+		AllocRegionPurge(Handle->Region, Ptr, Size);
+		return;
+	}
+#else
+	(void) Handle;
+#endif
+
+	AllocPurgeVirtual(Ptr, Size);
+}
+
+
+/* Zeroes memory. Big ranges have their whole pages purged and only the partial
+ * pages at the edges are written to.
+ */
+Static void
+AllocZeroMemory(
+	AllocHandleInternal* Handle,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+	if(Size < ALLOC_PURGE_ZERO_MIN || AllocHandleIsDirty(Handle))
+	{
+		(void) memset(Ptr, 0, Size);
+		return;
+	}
+
+	uint8_t* Start = ALLOC_ALIGN(Ptr, AllocPageSizeMask);
+	uint8_t* End = (uint8_t*) (((uintptr_t) Ptr + Size) & ~AllocPageSizeMask);
+
+	(void) memset(Ptr, 0, Start - (uint8_t*) Ptr);
+
+	AllocPurgeMemory(Handle, Start, End - Start);
+
+	(void) memset(End, 0, (uint8_t*) Ptr + Size - End);
+}
+
+
+/* Zeroes a free `Alloc4` object, except for its free list link, and sets its
+ * zero tag.
+ */
+Static void
+AllocPurgeObject4(
+	AllocHandleInternal* Handle,
+	uint8_t* Ptr
+	)
+{
+	AssertGE(Handle->AllocSize, ALLOC4_ZERO_TAG_MIN);
+
+	AllocZeroMemory(Handle, Ptr + ALLOC4_ZERO_TAG_MIN,
+		Handle->AllocSize - ALLOC4_ZERO_TAG_MIN);
+	Ptr[4] = 1;
+}
+
+
+Static void*
+AllocAlloc1Func(
+	AllocHandleInternal* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	(void) Size;
+
+	Alloc1Block* Block = (void*) Handle->Head;
+	if(!Block)
+	{
+		alloc_t BlockSize;
+
+		Block = (void*) AllocAllocBlock(Handle, &BlockSize);
+		if(!Block)
+		{
+			return NULL;
+		}
+
+		/*
+		Block->Prev = NULL;
+		Block->Next = NULL;
+		Block->Count = 0;
+		Block->Free = 0;
+		*/
+
+		alloc_t i = 0;
+		Alloc1* Alloc = Block->Allocs;
+
+		for(; i < Handle->AllocLimit - 1; ++i, ++Alloc)
+		{
+			Alloc->Next = i + 1;
+			/*
+			Alloc->Used = 0;
+			Alloc->Count = 0;
+			*/
+			Alloc->Free = UINT8_MAX;
+		}
+
+		Alloc->Next = UINT8_MAX;
+		/*
+		Alloc->Used = 0;
+		Alloc->Count = 0;
+		*/
+		Alloc->Free = UINT8_MAX;
+
+		++Handle->Allocators;
+		Handle->Head = (void*) Block;
+	}
+
+	Alloc1* Alloc = &Block->Allocs[Block->Free];
+
+	++Handle->Allocations;
+	++Block->Count;
+	++Alloc->Count;
+
+	if(Alloc->Count == ALLOC1_MAX)
+	{
+		if(Block->Count == ALLOC1_MAX * Handle->AllocLimit)
+		{
+			AllocUnlinkBlock(&Handle->Head, Block);
+			AllocPushBlock(&Handle->Full, Block);
+		}
+		else
+		{
+			Block->Free = Alloc->Next;
+		}
+	}
+
+	if(Alloc->Free != UINT8_MAX)
+	{
+		uint8_t* Ptr = Alloc->Data + Alloc->Free;
+		Alloc->Free = *Ptr;
+
+		if(Zero)
+		{
+			*Ptr = 0;
+		}
+
+		return Ptr;
+	}
+
+	uint8_t* Ptr = Alloc->Data + Alloc->Used++;
+
+	if(Zero && AllocHandleIsDirty(Handle))
+	{
+		*Ptr = 0;
+	}
+
+	return Ptr;
+}
+
+
+Static void
+AllocFree1Func(
+	AllocHandleInternal* Handle,
+	void* BlockPtr,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+	(void) Size;
+
+	Alloc1Block* Block = BlockPtr;
+	Alloc1* Alloc = &Block->Allocs[
+		((uintptr_t) Ptr - (uintptr_t) Block - sizeof(Alloc1Block))
+		/ sizeof(Alloc1)];
+
+	--Handle->Allocations;
+	--Block->Count;
+	--Alloc->Count;
+
+	if(Block->Count == ALLOC1_MAX * Handle->AllocLimit - 1)
+	{
+		AllocUnlinkBlock(&Handle->Full, Block);
+		AllocPushBlock(&Handle->Head, Block);
+	}
+
+	if(
+		Block->Count == 0 &&
+		(
+			(Handle->Flags & ALLOC_HANDLE_FLAG_IMMEDIATE_FREE) ||
+			(
+				Handle->Allocators > Handle->Spare &&
+				!(Handle->Flags & ALLOC_HANDLE_FLAG_DO_NOT_FREE) &&
+				Handle->Allocations <= ALLOC1_MAX * Handle->AllocLimit *
+					(Handle->Allocators - 1 - Handle->Spare)
+			)
+		)
+		)
+	{
+		AllocUnlinkBlock(&Handle->Head, Block);
+
+		(void) AllocFreeBlock(Handle, (void*) Block);
+
+		--Handle->Allocators;
+	}
+	else
+	{
+		if(Alloc->Count == ALLOC1_MAX - 1)
+		{
+			Alloc->Next = Block->Free;
+			Block->Free = Alloc - Block->Allocs;
+		}
+
+
+		*((uint8_t*) Ptr) = Alloc->Free;
+		Alloc->Free = (uint8_t*) Ptr - Alloc->Data;
+	}
+}
+
+
+Static void*
+AllocAlloc2Func(
+	AllocHandleInternal* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	(void) Size;
+
+	Alloc2* Alloc = (void*) Handle->Head;
+	if(!Alloc)
+	{
+		alloc_t BlockSize;
+
+		Alloc = (void*) AllocAllocBlock(Handle, &BlockSize);
+		if(!Alloc)
+		{
+			return NULL;
+		}
+
+		Alloc->Free = ALLOC2_MAX;
+
+		++Handle->Allocators;
+		Handle->Head = (void*) Alloc;
+	}
+
+	++Handle->Allocations;
+	++Alloc->Count;
+
+	uint8_t* Data = AllocGetBlockData(Handle, Alloc);
+
+	if(Alloc->Count == Handle->AllocLimit)
+	{
+		AllocUnlinkBlock(&Handle->Head, Alloc);
+		AllocPushBlock(&Handle->Full, Alloc);
+	}
+
+	if(Alloc->Free != ALLOC2_MAX)
+	{
+		void* Ptr = Data + Alloc->Free * 2;
+
+		(void) memcpy(&Alloc->Free, Ptr, 2);
+
+		if(Zero)
+		{
+			(void) memset(Ptr, 0, 2);
+		}
+
+		return Ptr;
+	}
+
+	void* Ptr = Data + Alloc->Used++ * 2;
+
+	if(Zero && AllocHandleIsDirty(Handle))
+	{
+		(void) memset(Ptr, 0, 2);
+	}
+
+	return Ptr;
+}
+
+
+Static void
+AllocFree2Func(
+	AllocHandleInternal* Handle,
+	void* BlockPtr,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+	(void) Size;
+
+	Alloc2* Alloc = BlockPtr;
+
+	--Handle->Allocations;
+	--Alloc->Count;
+
+	if(Alloc->Count == Handle->AllocLimit - 1)
+	{
+		AllocUnlinkBlock(&Handle->Full, Alloc);
+		AllocPushBlock(&Handle->Head, Alloc);
+	}
+
+	if(
+		Alloc->Count == 0 &&
+		(
+			(Handle->Flags & ALLOC_HANDLE_FLAG_IMMEDIATE_FREE) ||
+			(
+				Handle->Allocators > Handle->Spare &&
+				!(Handle->Flags & ALLOC_HANDLE_FLAG_DO_NOT_FREE) &&
+				Handle->Allocations <= Handle->AllocLimit *
+					(Handle->Allocators - 1 - Handle->Spare)
+			)
+		)
+		)
+	{
+		AllocUnlinkBlock(&Handle->Head, Alloc);
+
+		(void) AllocFreeBlock(Handle, (void*) Alloc);
+
+		--Handle->Allocators;
+	}
+	else
+	{
+		(void) memcpy(Ptr, &Alloc->Free, 2);
+
+		uint8_t* Data = AllocGetBlockData(Handle, Alloc);
+		Alloc->Free = ((uintptr_t) Ptr - (uintptr_t) Data) / 2;
+	}
+}
+
+
+Static void*
+AllocAlloc4Func(
+	AllocHandleInternal* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	Alloc4* Alloc = (void*) Handle->Head;
+	if(!Alloc)
+	{
+		Alloc = (void*) AllocTakeFullestBlock(Handle);
+	}
+
+	if(!Alloc)
+	{
+		alloc_t BlockSize;
+
+		Alloc = (void*) AllocAllocBlock(Handle, &BlockSize);
+		if(!Alloc)
+		{
+			return NULL;
+		}
+
+		Alloc->Free = ALLOC4_MAX;
+
+		if(BlockSize == Handle->BlockSize)
+		{
+			Alloc->Limit = Handle->AllocLimit;
+		}
+		else
+		{
+			Alloc->Limit = (BlockSize - Handle->Padding -
+				Handle->ColorMask * Handle->ColorStep) / Handle->AllocSize;
+		}
+
+		++Handle->Allocators;
+		Handle->Capacity += Alloc->Limit;
+		Handle->Head = (void*) Alloc;
+	}
+
+	++Handle->Allocations;
+	++Alloc->Count;
+
+	uint8_t* Data = AllocGetBlockData(Handle, Alloc);
+
+	if(Alloc->Count == Alloc->Limit)
+	{
+		AllocUnlinkBlock(&Handle->Head, Alloc);
+		AllocPushBlock(&Handle->Full, Alloc);
+	}
+
+	if(Alloc->Free != ALLOC4_MAX)
+	{
+		uint8_t* Ptr = Data + Alloc->Free * Handle->AllocSize;
+
+		(void) memcpy(&Alloc->Free, Ptr, 4);
+
+		if(Zero)
+		{
+			if(Handle->AllocSize >= ALLOC4_ZERO_TAG_MIN && Ptr[4])
+			{
+				(void) memset(Ptr, 0, ALLOC_MIN(Size,
+					(alloc_t) ALLOC4_ZERO_TAG_MIN));
+			}
+			else
+			{
+				AllocZeroMemory(Handle, Ptr, Size);
+			}
+		}
+
+		return Ptr;
+	}
+
+	uint8_t* Ptr = Data + Alloc->Used++ * Handle->AllocSize;
+
+	if(Zero && AllocHandleIsDirty(Handle))
+	{
+		(void) memset(Ptr, 0, Size);
+	}
+
+	return Ptr;
+}
+
+
+Static void
+AllocFree4Func(
+	AllocHandleInternal* Handle,
+	void* BlockPtr,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+	(void) Size;
+
+	Alloc4* Alloc = BlockPtr;
+
+	--Handle->Allocations;
+	--Alloc->Count;
+
+	AllocBlock** List =
+		AllocRebucketBlock(Handle, Alloc, Alloc->Count, Alloc->Limit);
+
+	if(
+		Alloc->Count == 0 &&
+		(
+			(Handle->Flags & ALLOC_HANDLE_FLAG_IMMEDIATE_FREE) ||
+			(
+				Handle->Allocators > Handle->Spare &&
+				!(Handle->Flags & ALLOC_HANDLE_FLAG_DO_NOT_FREE) &&
+				(Handle->Capacity - Alloc->Limit - Handle->Allocations) /
+					Alloc->Limit >= Handle->Spare
+			)
+		)
+		)
+	{
+		AllocUnlinkBlock(List, Alloc);
+
+		Handle->Capacity -= Alloc->Limit;
+
+		(void) AllocFreeBlock(Handle, (void*) Alloc);
+
+		--Handle->Allocators;
+	}
+	else
+	{
+		(void) memcpy(Ptr, &Alloc->Free, 4);
+
+		if(Handle->AllocSize >= ALLOC4_ZERO_TAG_MIN)
+		{
+			if(
+				(Handle->Flags & ALLOC_HANDLE_FLAG_PURGE_ON_FREE) &&
+				Handle->AllocSize >= ALLOC_PURGE_ZERO_MIN &&
+				!AllocHandleIsDirty(Handle)
+				)
+			{
+				AllocPurgeObject4(Handle, Ptr);
+			}
+			else
+			{
+				/* The contents are left as they are, so only a purge can
+				 * tell the object is zero again.
+				 */
+				((uint8_t*) Ptr)[4] = 0;
+			}
+		}
+
+		uint8_t* Data = AllocGetBlockData(Handle, Alloc);
+		alloc_t Offset = (uintptr_t) Ptr - (uintptr_t) Data;
+		Alloc->Free =
+			(uint32_t) (Offset >> Handle->DivShift) * Handle->DivInverse;
+	}
+}
+
+
+/* The number of bitmap words needed for `Count` objects, in whole groups.
+ */
+Static alloc_t
+AllocGetBitmapWords(
+	alloc_t Count
+	)
+{
+	alloc_t GroupBits = ALLOC_BITMAP_GROUP * 64;
+
+	return (Count + GroupBits - 1) / GroupBits * ALLOC_BITMAP_GROUP;
+}
+
+
+/* Returns the index of the first word with a clear bit, counting from `Bits`,
+ * which must be the start of a group. There must be such a word.
+ */
+Static alloc_t
+AllocFindClearWord(
+	const uint64_t* Bits
+	)
+{
+	alloc_t Word = 0;
+
+#if defined(__AVX2__)
+	static_assert(ALLOC_BITMAP_GROUP * 8 % sizeof(__m256i) == 0,
+		"AllocBitmap group size mismatch");
+
+	const __m256i Ones = _mm256_set1_epi8(-1);
+
+	while(1)
+	{
+		__m256i Group = _mm256_loadu_si256((const __m256i*) (Bits + Word));
+		uint32_t Full = _mm256_movemask_epi8(_mm256_cmpeq_epi8(Group, Ones));
+
+		if(Full != UINT32_MAX)
+		{
+			return Word + __builtin_ctz(~Full) / 8;
+		}
+
+		Word += sizeof(__m256i) / 8;
+	}
+#elif defined(__SSE2__)
+	static_assert(ALLOC_BITMAP_GROUP * 8 % sizeof(__m128i) == 0,
+		"AllocBitmap group size mismatch");
+
+	const __m128i Ones = _mm_set1_epi8(-1);
+
+	while(1)
+	{
+		__m128i Group = _mm_loadu_si128((const __m128i*) (Bits + Word));
+		uint32_t Full = _mm_movemask_epi8(_mm_cmpeq_epi8(Group, Ones));
+
+		if(Full != UINT16_MAX)
+		{
+			return Word + __builtin_ctz(~Full) / 8;
+		}
+
+		Word += sizeof(__m128i) / 8;
+	}
+#else
+	while(Bits[Word] == UINT64_MAX)
+	{
+		++Word;
+	}
+
+	return Word;
+#endif
+}
+
+
+Static void*
+AllocAllocBitmapFunc(
+	AllocHandleInternal* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	AllocBitmap* Alloc = (void*) Handle->Head;
+	if(!Alloc)
+	{
+		Alloc = (void*) AllocTakeFullestBlock(Handle);
+	}
+
+	if(!Alloc)
+	{
+		alloc_t BlockSize;
+
+		Alloc = (void*) AllocAllocBlock(Handle, &BlockSize);
+		if(!Alloc)
+		{
+			return NULL;
+		}
+
+		if(BlockSize == Handle->BlockSize)
+		{
+			Alloc->Limit = Handle->AllocLimit;
+		}
+		else
+		{
+			Alloc->Limit = (BlockSize - Handle->Padding -
+				Handle->ColorMask * Handle->ColorStep) / Handle->AllocSize;
+		}
+
+		++Handle->Allocators;
+		Handle->Capacity += Alloc->Limit;
+		Handle->Head = (void*) Alloc;
+	}
+
+	++Handle->Allocations;
+	++Alloc->Count;
+
+	if(Alloc->Count == Alloc->Limit)
+	{
+		AllocUnlinkBlock(&Handle->Head, Alloc);
+		AllocPushBlock(&Handle->Full, Alloc);
+	}
+
+	alloc_t Word = Alloc->Hint + AllocFindClearWord(Alloc->Bits + Alloc->Hint);
+	alloc_t Bit = __builtin_ctzll(~Alloc->Bits[Word]);
+
+	Alloc->Bits[Word] |= (uint64_t) 1 << Bit;
+	Alloc->Hint = Word & ~(alloc_t) (ALLOC_BITMAP_GROUP - 1);
+
+	alloc_t Index = Word * 64 + Bit;
+	uint8_t* Ptr = AllocGetBlockData(Handle, Alloc) + Index * Handle->AllocSize;
+
+	/* The lowest free object is always taken, so the objects that have never
+	 * been handed out are exactly those from `Used` on.
+	 */
+	if(Index < Alloc->Used)
+	{
+		if(Zero)
+		{
+			AllocZeroMemory(Handle, Ptr, Size);
+		}
+
+		return Ptr;
+	}
+
+	Alloc->Used = Index + 1;
+
+	if(Zero && AllocHandleIsDirty(Handle))
+	{
+		(void) memset(Ptr, 0, Size);
+	}
+
+	return Ptr;
+}
+
+
+Static void
+AllocFreeBitmapFunc(
+	AllocHandleInternal* Handle,
+	void* BlockPtr,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+	(void) Size;
+
+	AllocBitmap* Alloc = BlockPtr;
+
+	--Handle->Allocations;
+	--Alloc->Count;
+
+	AllocBlock** List =
+		AllocRebucketBlock(Handle, Alloc, Alloc->Count, Alloc->Limit);
+
+	if(
+		Alloc->Count == 0 &&
+		(
+			(Handle->Flags & ALLOC_HANDLE_FLAG_IMMEDIATE_FREE) ||
+			(
+				Handle->Allocators > Handle->Spare &&
+				!(Handle->Flags & ALLOC_HANDLE_FLAG_DO_NOT_FREE) &&
+				(Handle->Capacity - Alloc->Limit - Handle->Allocations) /
+					Alloc->Limit >= Handle->Spare
+			)
+		)
+		)
+	{
+		AllocUnlinkBlock(List, Alloc);
+
+		Handle->Capacity -= Alloc->Limit;
+
+		(void) AllocFreeBlock(Handle, (void*) Alloc);
+
+		--Handle->Allocators;
+	}
+	else
+	{
+		uint8_t* Data = AllocGetBlockData(Handle, Alloc);
+		alloc_t Offset = (uintptr_t) Ptr - (uintptr_t) Data;
+		uint32_t Index =
+			(uint32_t) (Offset >> Handle->DivShift) * Handle->DivInverse;
+
+		alloc_t Word = Index / 64;
+		uint64_t Bit = (uint64_t) 1 << (Index % 64);
+
+		AssertNEQ((Alloc->Bits[Word] & Bit), 0);
+
+		/* Without a zero tag, zeroing allocations clear the object again, but
+		 * that is cheap for pages that were already given back.
+		 */
+		if(
+			(Handle->Flags & ALLOC_HANDLE_FLAG_PURGE_ON_FREE) &&
+			Handle->AllocSize >= ALLOC_PURGE_ZERO_MIN &&
+			!AllocHandleIsDirty(Handle)
+			)
+		{
+			AllocZeroMemory(Handle, Ptr, Handle->AllocSize);
+		}
+
+		Alloc->Bits[Word] &= ~Bit;
+		Alloc->Hint = ALLOC_MIN(Alloc->Hint,
+			Word & ~(alloc_t) (ALLOC_BITMAP_GROUP - 1));
+	}
+}
+
+
+/* Gives the memory of an object with its own virtual memory back, without
+ * looking at `Handle->Virtual`.
+ */
+Static void
+AllocReleaseVirtual(
+	AllocHandleInternal* Handle,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+#ifdef __linux__
+	if(Handle->Region)
+	{
+		AllocRegionFree(Handle->Region, Ptr, AllocRegionGetChunkSize(Size));
+		return;
+	}
+#else
+	(void) Handle;
+#endif
+
+	AllocFreeVirtual(Ptr, Size);
+}
+
+
+/* Tables of virtual objects are allocated the same way as the objects, and so
+ * are the level lists of buddy handles.
+ */
+Static void*
+AllocAllocVirtualTable(
+	AllocHandleInternal* Handle,
+	alloc_t Size
+	)
+{
+#ifdef __linux__
+	if(Handle->Region)
+	{
+		void* Table = AllocRegionAlloc(Handle->Region, Size);
+
+		if(Table && AllocHandleIsDirty(Handle))
+		{
+			(void) memset(Table, 0, Size);
+		}
+
+		return Table;
+	}
+#endif
+
+	return AllocAllocVirtual(Size);
+}
+
+
+Static alloc_t
+AllocGetVirtualSlot(
+	AllocHandleInternal* Handle,
+	uintptr_t Ptr
+	)
+{
+	return (alloc_t) ((Ptr >> AllocPageSizeShift) *
+		(uintptr_t) UINT64_C(0x9E3779B97F4A7C15)) & Handle->VirtualMask;
+}
+
+
+Static void
+AllocPutVirtual(
+	AllocHandleInternal* Handle,
+	uintptr_t Ptr,
+	alloc_t Size
+	)
+{
+	alloc_t Slot = AllocGetVirtualSlot(Handle, Ptr);
+
+	while(Handle->Virtual[Slot].Ptr)
+	{
+		Slot = (Slot + 1) & Handle->VirtualMask;
+	}
+
+	Handle->Virtual[Slot].Ptr = Ptr;
+	Handle->Virtual[Slot].Size = Size;
+}
+
+
+/* Returns `0` if the table is full and could not be grown. The table is kept
+ * at most 3/4 full, and grows to a page's worth of entries first.
+ */
+Static int
+AllocTrackVirtual(
+	AllocHandleInternal* Handle,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+	alloc_t Capacity = Handle->Virtual ? Handle->VirtualMask + 1 : 0;
+
+	if((Handle->VirtualCount + 1) * 4 > Capacity * 3)
+	{
+		alloc_t NewCapacity = Capacity ? Capacity << 1 :
+			AllocPageSize / sizeof(AllocVirtualEntry);
+
+		AllocVirtualEntry* Table = AllocAllocVirtualTable(Handle,
+			NewCapacity * sizeof(AllocVirtualEntry));
+		if(!Table)
+		{
+			return 0;
+		}
+
+		AllocVirtualEntry* OldTable = Handle->Virtual;
+
+		Handle->Virtual = Table;
+		Handle->VirtualMask = NewCapacity - 1;
+
+		for(alloc_t i = 0; i < Capacity; ++i)
+		{
+			if(OldTable[i].Ptr)
+			{
+				AllocPutVirtual(Handle, OldTable[i].Ptr, OldTable[i].Size);
+			}
+		}
+
+		if(OldTable)
+		{
+			AllocReleaseVirtual(Handle, OldTable,
+				Capacity * sizeof(AllocVirtualEntry));
+		}
+	}
+
+	AllocPutVirtual(Handle, (uintptr_t) Ptr, Size);
+	++Handle->VirtualCount;
+
+	return 1;
+}
+
+
+/* Entries that follow the removed one in its run are moved back into the
+ * hole if their home slot allows it, so that lookups can stop at the first
+ * unused entry.
+ */
+Static void
+AllocUntrackVirtual(
+	AllocHandleInternal* Handle,
+	void* Ptr
+	)
+{
+	alloc_t Slot = AllocGetVirtualSlot(Handle, (uintptr_t) Ptr);
+
+	while(Handle->Virtual[Slot].Ptr != (uintptr_t) Ptr)
+	{
+		AssertNEQ(Handle->Virtual[Slot].Ptr, 0);
+		Slot = (Slot + 1) & Handle->VirtualMask;
+	}
+
+	alloc_t Next = Slot;
+
+	while(1)
+	{
+		Next = (Next + 1) & Handle->VirtualMask;
+
+		uintptr_t NextPtr = Handle->Virtual[Next].Ptr;
+		if(!NextPtr)
+		{
+			break;
+		}
+
+		alloc_t Home = AllocGetVirtualSlot(Handle, NextPtr);
+
+		/* Only move it if the hole lies between its home slot and where it
+		 * is now, cyclically.
+		 */
+		if(((Next - Home) & Handle->VirtualMask) >=
+			((Next - Slot) & Handle->VirtualMask))
+		{
+			Handle->Virtual[Slot] = Handle->Virtual[Next];
+			Slot = Next;
+		}
+	}
+
+	Handle->Virtual[Slot].Ptr = 0;
+	--Handle->VirtualCount;
+}
+
+
+/* Gives back every object with its own virtual memory, and the table.
+ */
+Static void
+AllocResetVirtual(
+	AllocHandleInternal* Handle
+	)
+{
+	if(!Handle->Virtual)
+	{
+		return;
+	}
+
+	alloc_t Capacity = Handle->VirtualMask + 1;
+
+	for(alloc_t i = 0; i < Capacity; ++i)
+	{
+		AllocVirtualEntry* Entry = &Handle->Virtual[i];
+
+		if(Entry->Ptr)
+		{
+			AllocReleaseVirtual(Handle, (void*) Entry->Ptr, Entry->Size);
+		}
+	}
+
+	AllocReleaseVirtual(Handle, Handle->Virtual,
+		Capacity * sizeof(AllocVirtualEntry));
+
+	Handle->Virtual = NULL;
+	Handle->VirtualCount = 0;
+	Handle->VirtualMask = 0;
+}
+
+
+Static void*
+AllocAllocVirtualFunc(
+	AllocHandleInternal* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	void* Ptr;
+
+#ifdef __linux__
+	if(Handle->Region)
+	{
+		Ptr = AllocRegionAlloc(Handle->Region, AllocRegionGetChunkSize(Size));
+
+		if(Ptr && Zero && AllocHandleIsDirty(Handle))
+		{
+			(void) memset(Ptr, 0, Size);
+		}
+	}
+	else
+	{
+		Ptr = AllocAllocVirtual(Size);
+	}
+#else
+	(void) Zero;
+
+	Ptr = AllocAllocVirtual(Size);
+#endif
+
+	if(Ptr && !AllocTrackVirtual(Handle, Ptr, Size))
+	{
+		AllocReleaseVirtual(Handle, Ptr, Size);
+		return NULL;
+	}
+
+	return Ptr;
+}
+
+
+Static void
+AllocFreeVirtualFunc(
+	AllocHandleInternal* Handle,
+	void* BlockPtr,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+	AssertEQ(BlockPtr, Ptr);
+
+	AllocUntrackVirtual(Handle, Ptr);
+	AllocReleaseVirtual(Handle, Ptr, Size);
+}
+
+
+/* Moves an object with its own virtual memory, which can not fail once the
+ * new memory is there, because the table only ever swaps one entry for
+ * another.
+ */
+Static void*
+AllocReallocVirtualFunc(
+	AllocHandleInternal* Handle,
+	void* Ptr,
+	alloc_t OldSize,
+	alloc_t NewSize
+	)
+{
+	void* NewPtr = AllocReallocVirtual(Ptr, OldSize, NewSize);
+
+	if(NewPtr)
+	{
+		AllocUntrackVirtual(Handle, Ptr);
+		AllocPutVirtual(Handle, (uintptr_t) NewPtr, NewSize);
+		++Handle->VirtualCount;
+	}
+
+	return NewPtr;
+}
+
+
+/* 4 bins per power of 2, except for the first few, which are exact.
+ */
+Static alloc_t
+AllocGetExtentBin(
+	alloc_t Pages
+	)
+{
+	if(Pages < 4)
+	{
+		return Pages;
+	}
+
+	alloc_t Log = AllocLog2Floor(Pages);
+
+	return Log * 4 + ((Pages >> (Log - 2)) & 3) - 4;
+}
+
+
+Static uint8_t*
+AllocGetExtentData(
+	AllocHandleInternal* Handle,
+	AllocExtentChunk* Chunk
+	)
+{
+	return (uint8_t*) Chunk + Handle->Padding;
+}
+
+
+Static void
+AllocMarkExtent(
+	AllocExtentChunk* Chunk,
+	alloc_t Page,
+	alloc_t Pages,
+	uint32_t Flags
+	)
+{
+	Chunk->Map[Page] = Pages | Flags;
+	Chunk->Map[Page + Pages - 1] = Pages | Flags;
+}
+
+
+Static void
+AllocPushExtent(
+	AllocExtentChunk* Chunk,
+	void* ExtentPtr,
+	alloc_t Pages
+	)
+{
+	AllocExtent* Extent = ExtentPtr;
+	alloc_t Bin = AllocGetExtentBin(Pages);
+
+	Extent->Prev = NULL;
+	Extent->Next = Chunk->Bins[Bin];
+
+	if(Extent->Next)
+	{
+		Extent->Next->Prev = Extent;
+	}
+
+	Chunk->Bins[Bin] = Extent;
+	Chunk->BinMask[Bin / 64] |= (uint64_t) 1 << (Bin % 64);
+}
+
+
+Static void
+AllocUnlinkExtent(
+	AllocExtentChunk* Chunk,
+	void* ExtentPtr,
+	alloc_t Pages
+	)
+{
+	AllocExtent* Extent = ExtentPtr;
+	alloc_t Bin = AllocGetExtentBin(Pages);
+
+	if(Extent->Prev)
+	{
+		Extent->Prev->Next = Extent->Next;
+	}
+	else
+	{
+		Chunk->Bins[Bin] = Extent->Next;
+
+		if(!Extent->Next)
+		{
+			Chunk->BinMask[Bin / 64] &= ~((uint64_t) 1 << (Bin % 64));
+		}
+	}
+
+	if(Extent->Next)
+	{
+		Extent->Next->Prev = Extent->Prev;
+	}
+}
+
+
+/* Returns the smallest free extent of at least `Pages` pages in their own bin,
+ * or else the first one of the next bin that is not empty, since all of those
+ * fit. `NULL` if there is none.
+ */
+Static AllocExtent*
+AllocFindExtent(
+	AllocHandleInternal* Handle,
+	AllocExtentChunk* Chunk,
+	alloc_t Pages
+	)
+{
+	uint8_t* Data = AllocGetExtentData(Handle, Chunk);
+	alloc_t Bin = AllocGetExtentBin(Pages);
+
+	AllocExtent* Best = NULL;
+	alloc_t BestPages = 0;
+
+	for(AllocExtent* Extent = Chunk->Bins[Bin]; Extent; Extent = Extent->Next)
+	{
+		alloc_t Page = ((uint8_t*) Extent - Data) >> AllocPageSizeShift;
+		alloc_t ExtentPages = Chunk->Map[Page] & ALLOC_EXTENT_PAGES;
+
+		if(ExtentPages >= Pages && (!Best || ExtentPages < BestPages))
+		{
+			Best = Extent;
+			BestPages = ExtentPages;
+
+			if(ExtentPages == Pages)
+			{
+				break;
+			}
+		}
+	}
+
+	if(Best)
+	{
+		return Best;
+	}
+
+	alloc_t First = (Bin + 1) / 64;
+
+	for(alloc_t Word = First; Word < ALLOC_ARRAYLEN(Chunk->BinMask); ++Word)
+	{
+		uint64_t Mask = Chunk->BinMask[Word];
+
+		if(Word == First)
+		{
+			Mask &= UINT64_MAX << ((Bin + 1) % 64);
+		}
+
+		if(Mask)
+		{
+			return Chunk->Bins[Word * 64 + __builtin_ctzll(Mask)];
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Takes `Pages` pages from a free extent of the chunk, or from the part that
+ * was never used. Returns `NULL` if neither has enough of them.
+ */
+Static void*
+AllocTakeExtent(
+	AllocHandleInternal* Handle,
+	AllocExtentChunk* Chunk,
+	alloc_t Pages,
+	alloc_t Size,
+	int Zero
+	)
+{
+	uint8_t* Data = AllocGetExtentData(Handle, Chunk);
+	AllocExtent* Extent = AllocFindExtent(Handle, Chunk, Pages);
+
+	if(Extent)
+	{
+		alloc_t Page = ((uint8_t*) Extent - Data) >> AllocPageSizeShift;
+		uint32_t Entry = Chunk->Map[Page];
+		alloc_t ExtentPages = Entry & ALLOC_EXTENT_PAGES;
+
+		AllocUnlinkExtent(Chunk, Extent, ExtentPages);
+
+		/* The rest does not start at the first page, so it is still purged if
+		 * the extent was.
+		 */
+		if(ExtentPages > Pages)
+		{
+			alloc_t Rest = Page + Pages;
+			alloc_t RestPages = ExtentPages - Pages;
+
+			AllocMarkExtent(Chunk, Rest, RestPages,
+				ALLOC_EXTENT_FREE | (Entry & ALLOC_EXTENT_PURGED));
+			AllocPushExtent(Chunk, Data + (Rest << AllocPageSizeShift),
+				RestPages);
+		}
+
+		AllocMarkExtent(Chunk, Page, Pages, 0);
+
+		if(Zero)
+		{
+			if(Entry & ALLOC_EXTENT_PURGED)
+			{
+				(void) memset(Extent, 0, ALLOC_MIN(Size, AllocPageSize));
+			}
+			else
+			{
+				AllocZeroMemory(Handle, Extent, Size);
+			}
+		}
+
+		return Extent;
+	}
+
+	if(Chunk->Used + Pages > Handle->AllocLimit)
+	{
+		return NULL;
+	}
+
+	alloc_t Page = Chunk->Used;
+	Chunk->Used += Pages;
+
+	AllocMarkExtent(Chunk, Page, Pages, 0);
+
+	uint8_t* Ptr = Data + (Page << AllocPageSizeShift);
+
+	if(Zero && AllocHandleIsDirty(Handle))
+	{
+		(void) memset(Ptr, 0, Size);
+	}
+
+	return Ptr;
+}
+
+
+Static void*
+AllocAllocExtentFunc(
+	AllocHandleInternal* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	if(Size > Handle->AllocSize)
+	{
+		return AllocAllocVirtualFunc(Handle, Size, Zero);
+	}
+
+	alloc_t Pages = (Size + AllocPageSizeMask) >> AllocPageSizeShift;
+
+	/* The chunk that last had room goes first, and usually still has it, so
+	 * that most allocations only look at one chunk.
+	 */
+	AllocExtentChunk* Chunk = (void*) Handle->Head;
+	void* Ptr = NULL;
+
+	for(; Chunk; Chunk = Chunk->Next)
+	{
+		Ptr = AllocTakeExtent(Handle, Chunk, Pages, Size, Zero);
+		if(Ptr)
+		{
+			if(Chunk != (void*) Handle->Head)
+			{
+				AllocUnlinkBlock(&Handle->Head, Chunk);
+				AllocPushBlock(&Handle->Head, Chunk);
+			}
+
+			break;
+		}
+	}
+
+	if(!Ptr)
+	{
+		alloc_t BlockSize;
+
+		Chunk = (void*) AllocAllocBlock(Handle, &BlockSize);
+		if(!Chunk)
+		{
+			return NULL;
+		}
+
+		++Handle->Allocators;
+		Handle->Capacity += Handle->AllocLimit;
+		AllocPushBlock(&Handle->Head, Chunk);
+
+		Ptr = AllocTakeExtent(Handle, Chunk, Pages, Size, Zero);
+	}
+
+	++Chunk->Count;
+	Handle->Allocations += Pages;
+
+	return Ptr;
+}
+
+
+Static void
+AllocFreeExtentFunc(
+	AllocHandleInternal* Handle,
+	void* BlockPtr,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+	if(Size > Handle->AllocSize)
+	{
+		AllocFreeVirtualFunc(Handle, Ptr, Ptr, Size);
+		return;
+	}
+
+	AllocExtentChunk* Chunk = BlockPtr;
+	uint8_t* Data = AllocGetExtentData(Handle, Chunk);
+
+	alloc_t Pages = (Size + AllocPageSizeMask) >> AllocPageSizeShift;
+	alloc_t Page = ((uint8_t*) Ptr - Data) >> AllocPageSizeShift;
+
+	AssertEQ(Chunk->Map[Page], Pages);
+
+	Handle->Allocations -= Pages;
+	--Chunk->Count;
+
+	if(
+		Chunk->Count == 0 &&
+		(
+			(Handle->Flags & ALLOC_HANDLE_FLAG_IMMEDIATE_FREE) ||
+			(
+				Handle->Allocators > Handle->Spare &&
+				!(Handle->Flags & ALLOC_HANDLE_FLAG_DO_NOT_FREE) &&
+				(Handle->Capacity - Handle->AllocLimit - Handle->Allocations) /
+					Handle->AllocLimit >= Handle->Spare
+			)
+		)
+		)
+	{
+		AllocUnlinkBlock(&Handle->Head, Chunk);
+
+		Handle->Capacity -= Handle->AllocLimit;
+
+		(void) AllocFreeBlock(Handle, (void*) Chunk);
+
+		--Handle->Allocators;
+
+		return;
+	}
+
+	alloc_t End = Page + Pages;
+
+	if(End < Chunk->Used && (Chunk->Map[End] & ALLOC_EXTENT_FREE))
+	{
+		alloc_t NextPages = Chunk->Map[End] & ALLOC_EXTENT_PAGES;
+
+		AllocUnlinkExtent(Chunk, Data + (End << AllocPageSizeShift), NextPages);
+		Pages += NextPages;
+	}
+
+	if(Page && (Chunk->Map[Page - 1] & ALLOC_EXTENT_FREE))
+	{
+		alloc_t PrevPages = Chunk->Map[Page - 1] & ALLOC_EXTENT_PAGES;
+		Page -= PrevPages;
+
+		AllocUnlinkExtent(Chunk, Data + (Page << AllocPageSizeShift),
+			PrevPages);
+		Pages += PrevPages;
+	}
+
+	uint8_t* Extent = Data + (Page << AllocPageSizeShift);
+	uint32_t Flags = ALLOC_EXTENT_FREE;
+
+	if(
+		(Handle->Flags & ALLOC_HANDLE_FLAG_PURGE_ON_FREE) &&
+		Pages > 1 && !AllocHandleIsDirty(Handle)
+		)
+	{
+		AllocPurgeMemory(Handle, Extent + AllocPageSize,
+			(Pages - 1) << AllocPageSizeShift);
+		Flags |= ALLOC_EXTENT_PURGED;
+	}
+
+	AllocMarkExtent(Chunk, Page, Pages, Flags);
+	AllocPushExtent(Chunk, Extent, Pages);
+}
+
+
+/* The level of objects of `Size` bytes, `0` being the smallest objects.
+ */
+Static uint32_t
+AllocGetBuddyLevel(
+	AllocHandleInternal* Handle,
+	alloc_t Size
+	)
+{
+	alloc_t Units = (Size - 1) >> Handle->DivShift;
+
+	return Units ? AllocLog2Floor(Units) + 1 : 0;
+}
+
+
+Static alloc_t
+AllocGetBuddyBit(
+	AllocHandleInternal* Handle,
+	uint32_t Level,
+	alloc_t Index
+	)
+{
+	alloc_t Objects = Handle->BlockSize >> Handle->DivShift;
+
+	return Objects * 2 - ((Objects * 2) >> Level) + Index;
+}
+
+
+Static void
+AllocPushBuddy(
+	AllocHandleInternal* Handle,
+	AllocBuddy* Block,
+	uint32_t Level,
+	alloc_t Index
+	)
+{
+	AllocBuddyFree* Free = (void*) ((uint8_t*) Block +
+		(Index << (Handle->DivShift + Level)));
+
+	Free->Prev = NULL;
+	Free->Next = Block->Lists[Level];
+
+	if(Free->Next)
+	{
+		Free->Next->Prev = Free;
+	}
+
+	Block->Lists[Level] = Free;
+	Block->LevelMask |= UINT32_C(1) << Level;
+
+	alloc_t Bit = AllocGetBuddyBit(Handle, Level, Index);
+	Block->Bits[Bit / 64] |= (uint64_t) 1 << (Bit % 64);
+}
+
+
+Static void
+AllocUnlinkBuddy(
+	AllocHandleInternal* Handle,
+	AllocBuddy* Block,
+	uint32_t Level,
+	alloc_t Index
+	)
+{
+	AllocBuddyFree* Free = (void*) ((uint8_t*) Block +
+		(Index << (Handle->DivShift + Level)));
+
+	if(Free->Prev)
+	{
+		Free->Prev->Next = Free->Next;
+	}
+	else
+	{
+		Block->Lists[Level] = Free->Next;
+
+		if(!Free->Next)
+		{
+			Block->LevelMask &= ~(UINT32_C(1) << Level);
+		}
+	}
+
+	if(Free->Next)
+	{
+		Free->Next->Prev = Free->Prev;
+	}
+
+	alloc_t Bit = AllocGetBuddyBit(Handle, Level, Index);
+	Block->Bits[Bit / 64] &= ~((uint64_t) 1 << (Bit % 64));
+}
+
+
+/* Frees everything past the header, in the biggest aligned objects that fit.
+ * The last one is always the second half of the block.
+ */
+Static void
+AllocInitBuddy(
+	AllocHandleInternal* Handle,
+	AllocBuddy* Block
+	)
+{
+	alloc_t Offset = Handle->Padding;
+
+	while(Offset < Handle->BlockSize)
+	{
+		uint32_t Level = AllocLog2(Offset) - Handle->DivShift;
+
+		AllocPushBuddy(Handle, Block, Level,
+			Offset >> (Handle->DivShift + Level));
+
+		Offset += (alloc_t) 1 << (Handle->DivShift + Level);
+	}
+}
+
+
+/* The list the block is on, that of the level of its biggest free object, or
+ * `Full` if it has none.
+ */
+Static AllocBlock**
+AllocGetBuddyList(
+	AllocHandleInternal* Handle,
+	AllocBuddy* Block
+	)
+{
+	if(!Block->LevelMask)
+	{
+		return &Handle->Full;
+	}
+
+	return &Handle->Levels[AllocLog2Floor(Block->LevelMask)];
+}
+
+
+Static void*
+AllocAllocBuddyFunc(
+	AllocHandleInternal* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	uint32_t Level = AllocGetBuddyLevel(Handle, Size);
+	uint32_t Mask = UINT32_MAX << Level;
+
+	if(!Handle->Levels)
+	{
+		Handle->Levels = AllocAllocVirtualTable(Handle,
+			ALLOC_BUDDY_LEVELS * sizeof(AllocBlock*));
+
+		if(!Handle->Levels)
+		{
+			return NULL;
+		}
+	}
+
+	AllocBuddy* Block = NULL;
+
+	for(uint32_t Top = Level; Top < ALLOC_BUDDY_LEVELS; ++Top)
+	{
+		if(Handle->Levels[Top])
+		{
+			Block = (void*) Handle->Levels[Top];
+			AllocUnlinkBlock(&Handle->Levels[Top], Block);
+
+			break;
+		}
+	}
+
+	if(!Block)
+	{
+		alloc_t BlockSize;
+
+		Block = (void*) AllocAllocBlock(Handle, &BlockSize);
+		if(!Block)
+		{
+			return NULL;
+		}
+
+		++Handle->Allocators;
+		Handle->Capacity += Handle->AllocLimit;
+
+		AllocInitBuddy(Handle, Block);
+	}
+
+	/* Takes the smallest free object that fits, and splits off its upper
+	 * halves until it is of the right size.
+	 */
+	uint32_t Free = __builtin_ctz(Block->LevelMask & Mask);
+	uint8_t* Ptr = (void*) Block->Lists[Free];
+	alloc_t Index = (Ptr - (uint8_t*) Block) >> (Handle->DivShift + Free);
+
+	AllocUnlinkBuddy(Handle, Block, Free, Index);
+
+	while(Free > Level)
+	{
+		--Free;
+		Index <<= 1;
+
+		AllocPushBuddy(Handle, Block, Free, Index + 1);
+	}
+
+	AllocPushBlock(AllocGetBuddyList(Handle, Block), Block);
+
+	++Block->Count;
+	Handle->Allocations += (alloc_t) 1 << Level;
+
+	if(Zero)
+	{
+		AllocZeroMemory(Handle, Ptr, Size);
+	}
+
+	return Ptr;
+}
+
+
+Static void
+AllocFreeBuddyFunc(
+	AllocHandleInternal* Handle,
+	void* BlockPtr,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+	AllocBuddy* Block = BlockPtr;
+
+	uint32_t Level = AllocGetBuddyLevel(Handle, Size);
+	alloc_t Index =
+		((uint8_t*) Ptr - (uint8_t*) Block) >> (Handle->DivShift + Level);
+
+	Handle->Allocations -= (alloc_t) 1 << Level;
+	--Block->Count;
+
+	AllocUnlinkBlock(AllocGetBuddyList(Handle, Block), Block);
+
+	if(
+		Block->Count == 0 &&
+		(
+			(Handle->Flags & ALLOC_HANDLE_FLAG_IMMEDIATE_FREE) ||
+			(
+				Handle->Allocators > Handle->Spare &&
+				!(Handle->Flags & ALLOC_HANDLE_FLAG_DO_NOT_FREE) &&
+				(Handle->Capacity - Handle->AllocLimit - Handle->Allocations) /
+					Handle->AllocLimit >= Handle->Spare
+			)
+		)
+		)
+	{
+		Handle->Capacity -= Handle->AllocLimit;
+
+		(void) AllocFreeBlock(Handle, (void*) Block);
+
+		--Handle->Allocators;
+
+		return;
+	}
+
+	/* The top level is the whole block, which is never free, since the header
+	 * is in it.
+	 */
+	uint32_t TopLevel = AllocLog2(Handle->BlockSize) - Handle->DivShift;
+
+	for(; Level < TopLevel - 1; ++Level, Index >>= 1)
+	{
+		alloc_t Bit = AllocGetBuddyBit(Handle, Level, Index ^ 1);
+
+		if(!(Block->Bits[Bit / 64] & ((uint64_t) 1 << (Bit % 64))))
+		{
+			break;
+		}
+
+		AllocUnlinkBuddy(Handle, Block, Level, Index ^ 1);
+	}
+
+	AllocPushBuddy(Handle, Block, Level, Index);
+	AllocPushBlock(AllocGetBuddyList(Handle, Block), Block);
+}
+
+
+/* Bumps `Used` of the newest block past `Size` more bytes. Returns `NULL` if
+ * there is no block, or it does not have that many left.
+ */
+Static void*
+AllocBumpArena(
+	AllocHandleInternal* Handle,
+	alloc_t Size
+	)
+{
+	AllocArena* Block = (void*) Handle->Head;
+	if(!Block)
+	{
+		return NULL;
+	}
+
+	alloc_t Mask = Handle->Info.Alignment - 1;
+	alloc_t Offset = (Block->Used + Mask) & ~Mask;
+
+	if(Offset + Size > Handle->BlockSize)
+	{
+		return NULL;
+	}
+
+	Handle->Allocations += Offset + Size - Block->Used;
+	Block->Used = Offset + Size;
+
+	return (uint8_t*) Block + Offset;
+}
+
+
+Static void*
+AllocAllocArenaFunc(
+	AllocHandleInternal* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	uint8_t* Ptr = AllocBumpArena(Handle, Size);
+
+	if(!Ptr)
+	{
+		AllocArena* Block = (void*) Handle->Full;
+
+		if(Block)
+		{
+			AllocUnlinkBlock(&Handle->Full, Block);
+		}
+		else
+		{
+			alloc_t BlockSize;
+
+			Block = (void*) AllocAllocBlock(Handle, &BlockSize);
+			if(!Block)
+			{
+				return NULL;
+			}
+
+			++Handle->Allocators;
+			Handle->Capacity += Handle->AllocLimit;
+		}
+
+		AllocPushBlock(&Handle->Head, Block);
+
+		Block->Used = Handle->Padding;
+
+		Ptr = AllocBumpArena(Handle, Size);
+	}
+
+	/* The block the arena keeps when it is reset has garbage in it, and so
+	 * do the ones stacks keep.
+	 */
+	if(Zero)
+	{
+		(void) memset(Ptr, 0, Size);
+	}
+
+	return Ptr;
+}
+
+
+Static void
+AllocFreeArenaFunc(
+	AllocHandleInternal* Handle,
+	void* BlockPtr,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+	(void) Handle;
+	(void) BlockPtr;
+	(void) Ptr;
+	(void) Size;
+}
+
+
+/* Only the most recent object is actually freed. A block it leaves empty is
+ * set aside like `AllocStackRestoreUH` does, so that the most recent object
+ * is at the end of the new `Head` again.
+ */
+Static void
+AllocFreeStackFunc(
+	AllocHandleInternal* Handle,
+	void* BlockPtr,
+	void* Ptr,
+	alloc_t Size
+	)
+{
+	AllocArena* Block = BlockPtr;
+
+	if(
+		Block != (void*) Handle->Head ||
+		(uint8_t*) Ptr + Size != (uint8_t*) Block + Block->Used
+		)
+	{
+		return;
+	}
+
+	Block->Used -= Size;
+	Handle->Allocations -= Size;
+
+	if(Block->Used != Handle->Padding)
+	{
+		return;
+	}
+
+	AllocUnlinkBlock(&Handle->Head, Block);
+
+	if(Handle->Flags & ALLOC_HANDLE_FLAG_IMMEDIATE_FREE)
+	{
+		Handle->Capacity -= Handle->AllocLimit;
+
+		(void) AllocFreeBlock(Handle, (void*) Block);
+		--Handle->Allocators;
+	}
+	else
+	{
+		AllocPushBlock(&Handle->Full, Block);
+	}
+}
+
+
+Static const AllocAllocFunc AllocAllocFuncs[] =
+(const AllocAllocFunc[])
+{
+	AllocAllocVirtualFunc,
+	AllocAlloc1Func,
+	AllocAlloc2Func,
+	AllocAlloc4Func,
+	AllocAllocBitmapFunc,
+	AllocAllocExtentFunc,
+	AllocAllocBuddyFunc,
+	AllocAllocArenaFunc,
+	AllocAllocArenaFunc
+};
+
+Static const AllocFreeFunc AllocFreeFuncs[] =
+(const AllocFreeFunc[])
+{
+	AllocFreeVirtualFunc,
+	AllocFree1Func,
+	AllocFree2Func,
+	AllocFree4Func,
+	AllocFreeBitmapFunc,
+	AllocFreeExtentFunc,
+	AllocFreeBuddyFunc,
+	AllocFreeArenaFunc,
+	AllocFreeStackFunc
+};
+
+
+Static int
+AllocHandleIsVirtual(
+	_in_ AllocHandleInternal* Handle
+	)
+{
+	return !Handle->BlockSize;
+}
+
+
+Static void
+AllocInitHandleDivision(
+	AllocHandleInternal* Handle
+	)
+{
+	/* Newton's iteration doubles the number of correct low bits, and any odd
+	 * number is its own inverse modulo 8.
+	 */
+	uint32_t Odd = Handle->AllocSize >> AllocLog2(Handle->AllocSize);
+	uint32_t Inverse = Odd;
+
+	for(int i = 0; i < 4; ++i)
+	{
+		Inverse *= 2 - Odd * Inverse;
+	}
+
+	Handle->DivShift = AllocLog2(Handle->AllocSize);
+	Handle->DivInverse = Inverse;
+}
+
+
+/* Blocks of handles with a `Region` come from it, not from a private nursery.
+ */
+Static void
+AllocInitHandle(
+	_in_ AllocHandleInfo* Info,
+	_opaque_ AllocHandle* Handle,
+	AllocRegion* Region
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+
+#if ALLOC_THREADS == 1
+	AllocMutexInit(&HandleInternal->Mutex);
+#endif
+
+	HandleInternal->Allocators = 0;
+	HandleInternal->Allocations = 0;
+
+	HandleInternal->Head = NULL;
+	HandleInternal->Full = NULL;
+
+	for(alloc_t i = 0; i < ALLOC_BUCKETS; ++i)
+	{
+		HandleInternal->Buckets[i] = NULL;
+	}
+
+	HandleInternal->Levels = NULL;
+
+	HandleInternal->Flags = ALLOC_HANDLE_FLAG_NONE;
+
+	HandleInternal->HeaderOffset = 0;
+
+	HandleInternal->ColorMask = 0;
+	HandleInternal->ColorStep = 0;
+	HandleInternal->DataMask = ~(alloc_t) 0;
+
+	HandleInternal->Nursery = 0;
+	HandleInternal->NurseryMin = 0;
+	HandleInternal->NurserySlots = 0;
+	HandleInternal->NurseryUsed = 0;
+
+	HandleInternal->Capacity = 0;
+	HandleInternal->Footprint = 0;
+	HandleInternal->Spare = ALLOC_DEFAULT_SPARE;
+
+	HandleInternal->Region = Region;
+
+	HandleInternal->Virtual = NULL;
+	HandleInternal->VirtualCount = 0;
+	HandleInternal->VirtualMask = 0;
+
+
+	if(!Info)
+	{
+		HandleInternal->Padding = 0;
+		HandleInternal->AllocLimit = 0;
+		HandleInternal->AllocSize = 0;
+		HandleInternal->BlockSize = 0;
+
+		HandleInternal->Info = (AllocHandleInfo){0};
+
+		HandleInternal->Engine = 0;
+
+		return;
+	}
+
+
+	AssertNEQ(Info->Alignment, 0);
+	AssertEQ(ALLOC_IS_POWER_OF_2(Info->Alignment), 1);
+
+	HandleInternal->Info = *Info;
+
+	if(Info->Spare)
+	{
+		HandleInternal->Spare = AllocResolveSpare(Info->Spare);
+	}
+
+
+	static const alloc_t AllocLimitMax[] =
+	(const alloc_t[])
+	{
+		0,
+		ALLOC1_LIMIT_MAX,
+		UINT16_MAX - 2,
+		UINT32_MAX - 2
+	};
+
+	/* Blocks that fit the most objects of the smaller engines. `Alloc1`
+	 * rounds up, since its limit of sub-allocators only just misses 64KiB.
+	 * The limit of `Alloc2` only just overshoots 128KiB though, so it rounds
+	 * down rather than leave half of a 256KiB block unused. Blocks are never
+	 * smaller than a page, so on kernels with big pages, those engines hold
+	 * as many objects per block as the page fits, and only then are they
+	 * capped by the limits above.
+	 */
+	const alloc_t BlockSizeMax[] =
+	{
+		0,
+		ALLOC_MAX((alloc_t) AllocGetNextPO2(sizeof(Alloc1Block) +
+			sizeof(Alloc1) * AllocLimitMax[1]), AllocPageSize),
+		ALLOC_MAX((alloc_t) 1 << AllocLog2Floor(sizeof(Alloc2) +
+			2 * AllocLimitMax[2]), AllocPageSize),
+		1073741824
+	};
+
+	/* Bitmaps work the same for objects of any size, so they share the limits
+	 * of `Alloc4`.
+	 */
+	int Bitmap = Info->Type == ALLOC_HANDLE_TYPE_BITMAP;
+	alloc_t TableIndex = Bitmap ? 3 : ALLOC_MIN(Info->AllocSize, 3U);
+
+
+	if(Info->Type == ALLOC_HANDLE_TYPE_EXTENT)
+	{
+		alloc_t AllocSize =
+			(Info->AllocSize + AllocPageSizeMask) & ~AllocPageSizeMask;
+
+		alloc_t BlockSize = Info->BlockSize;
+		BlockSize = ALLOC_MIN(BlockSize, BlockSizeMax[3]);
+		BlockSize = ALLOC_MAX(BlockSize, AllocPageSize);
+		BlockSize = AllocGetNextPO2(BlockSize);
+
+		/* The header and the map, 4 bytes per page, take whole pages at the
+		 * beginning of the chunk. The rest must fit the biggest extent.
+		 */
+		alloc_t Padding;
+
+		while(1)
+		{
+			Padding = sizeof(AllocExtentChunk) +
+				(BlockSize >> AllocPageSizeShift) * 4;
+			Padding = (Padding + AllocPageSizeMask) & ~AllocPageSizeMask;
+
+			if(Padding + AllocSize <= BlockSize)
+			{
+				break;
+			}
+
+			BlockSize <<= 1;
+		}
+
+		HandleInternal->Padding = Padding;
+		HandleInternal->AllocLimit =
+			(BlockSize - Padding) >> AllocPageSizeShift;
+		HandleInternal->AllocSize = AllocSize;
+		HandleInternal->BlockSize = BlockSize;
+
+		HandleInternal->Engine = 5;
+
+		return;
+	}
+
+
+	if(Info->Type == ALLOC_HANDLE_TYPE_BUDDY)
+	{
+		/* The smallest objects must fit the free list links.
+		 */
+		alloc_t MinSize = ALLOC_MAX(Info->Alignment, sizeof(AllocBuddyFree));
+		MinSize = AllocGetNextPO2(MinSize);
+
+		alloc_t AllocSize = ALLOC_MAX(Info->AllocSize, MinSize);
+		AllocSize = AllocGetNextPO2(AllocSize);
+
+		alloc_t BlockSize = Info->BlockSize;
+		BlockSize = ALLOC_MIN(BlockSize, BlockSizeMax[3]);
+		BlockSize = ALLOC_MAX(BlockSize, AllocPageSize);
+		BlockSize = AllocGetNextPO2(BlockSize);
+
+		/* The header takes the first objects of the block, so only the second
+		 * half of it is ever free as a whole, and it must fit the biggest
+		 * objects.
+		 */
+		alloc_t Padding;
+
+		while(1)
+		{
+			alloc_t Bits = (BlockSize / MinSize) * 2;
+
+			Padding = sizeof(AllocBuddy) + (Bits + 63) / 64 * 8;
+			Padding = (Padding + MinSize - 1) & ~(MinSize - 1);
+
+			if(Padding <= BlockSize / 2 && AllocSize <= BlockSize / 2)
+			{
+				break;
+			}
+
+			BlockSize <<= 1;
+		}
+
+		AssertLE(AllocLog2(BlockSize / MinSize), ALLOC_BUDDY_LEVELS - 1);
+
+		HandleInternal->Padding = Padding;
+		HandleInternal->AllocLimit = (BlockSize - Padding) / MinSize;
+		HandleInternal->AllocSize = AllocSize;
+		HandleInternal->BlockSize = BlockSize;
+
+		HandleInternal->DivShift = AllocLog2(MinSize);
+		HandleInternal->DivInverse = 1;
+
+		HandleInternal->Engine = 6;
+
+		return;
+	}
+
+
+	if(
+		Info->Type == ALLOC_HANDLE_TYPE_ARENA ||
+		Info->Type == ALLOC_HANDLE_TYPE_STACK
+		)
+	{
+		alloc_t Mask = Info->Alignment - 1;
+		alloc_t Padding = (sizeof(AllocArena) + Mask) & ~Mask;
+
+		alloc_t BlockSize = Info->BlockSize;
+		BlockSize = ALLOC_MIN(BlockSize, BlockSizeMax[3]);
+		BlockSize = ALLOC_MAX(BlockSize, AllocPageSize);
+		BlockSize = AllocGetNextPO2(BlockSize);
+
+		while(Padding + Info->AllocSize > BlockSize)
+		{
+			BlockSize <<= 1;
+		}
+
+		/* In bytes, as are `Allocations` and `Capacity`.
+		 */
+		HandleInternal->Padding = Padding;
+		HandleInternal->AllocLimit = BlockSize - Padding;
+		HandleInternal->AllocSize = Info->AllocSize;
+		HandleInternal->BlockSize = BlockSize;
+
+		HandleInternal->Engine = Info->Type == ALLOC_HANDLE_TYPE_ARENA ? 7 : 8;
+
+		return;
+	}
+
+
+	if(Info->AllocSize == 1 && !Bitmap)
+	{
+		alloc_t BlockSize = Info->BlockSize;
+		BlockSize = ALLOC_MIN(BlockSize, BlockSizeMax[TableIndex]);
+		BlockSize = ALLOC_MAX(BlockSize, AllocPageSize);
+		BlockSize = AllocGetNextPO2(BlockSize);
+
+		alloc_t AllocLimit =
+			(BlockSize - sizeof(Alloc1Block)) / sizeof(Alloc1);
+		AllocLimit = ALLOC_MIN(AllocLimit, AllocLimitMax[TableIndex]);
+		AllocLimit = ALLOC_MAX(AllocLimit, 1U);
+
+		BlockSize = sizeof(Alloc1Block) + AllocLimit * sizeof(Alloc1);
+		BlockSize = AllocGetNextPO2(BlockSize);
+
+		HandleInternal->Padding = 0;
+		HandleInternal->AllocLimit = AllocLimit;
+		HandleInternal->AllocSize = 1;
+		HandleInternal->BlockSize = BlockSize;
+
+		HandleInternal->Engine = TableIndex;
+
+		return;
+	}
+
+
+	alloc_t BlockSize = Info->BlockSize;
+	BlockSize = ALLOC_MIN(BlockSize, BlockSizeMax[TableIndex]);
+	BlockSize = ALLOC_MAX(BlockSize, AllocPageSize);
+	BlockSize = AllocGetNextPO2(BlockSize);
+
+	/* Bitmaps are sized for as many objects as could share the block with
+	 * them, which is a few more than actually fit after the padding, but
+	 * always at least one, since blocks hold at least one object.
+	 */
+	alloc_t BitmapLimit = 0;
+	alloc_t HeaderSize;
+
+	if(Bitmap)
+	{
+		BitmapLimit = (BlockSize - sizeof(AllocBitmap)) * 8 /
+			(Info->AllocSize * 8 + 1);
+		BitmapLimit = ALLOC_MAX(BitmapLimit, 1U);
+		HeaderSize = sizeof(AllocBitmap) +
+			AllocGetBitmapWords(BitmapLimit) * 8;
+	}
+	else
+	{
+		HeaderSize = Info->AllocSize == 2 ? sizeof(Alloc2) : sizeof(Alloc4);
+	}
+
+	alloc_t Mask = Info->Alignment - 1;
+	alloc_t Padding = (HeaderSize + Mask) & ~Mask;
+
+	/* If aligning the first object past the header would waste at least
+	 * a page, the header is instead moved out of line into its own page right
+	 * before the block, so that the whole block holds objects. Blocks are then
+	 * made at least as big as the alignment, since the objects start exactly
+	 * at the beginning of the block. Region chunks are naturally aligned, so
+	 * that extra page would double the chunk, which is worse than the padding.
+	 * So would bitmaps that do not fit the page.
+	 */
+	alloc_t HeaderOffset = 0;
+
+	if(TableIndex == 3 && Padding >= AllocPageSize && !Region)
+	{
+		alloc_t OutBlockSize = ALLOC_MAX(BlockSize, Info->Alignment);
+		alloc_t OutBitmapLimit =
+			ALLOC_MAX(OutBlockSize / Info->AllocSize, (alloc_t) 1);
+		alloc_t OutHeaderSize = HeaderSize;
+
+		if(Bitmap)
+		{
+			OutHeaderSize = sizeof(AllocBitmap) +
+				AllocGetBitmapWords(OutBitmapLimit) * 8;
+		}
+
+		if(OutHeaderSize <= AllocPageSize)
+		{
+			HeaderOffset = AllocPageSize;
+			Padding = AllocPageSize;
+
+			BlockSize = OutBlockSize;
+			HeaderSize = OutHeaderSize;
+			BitmapLimit = OutBitmapLimit;
+		}
+	}
+
+	/* Colored out-of-line headers move around within their page, and inline
+	 * ones take the first object with them, in steps that keep it aligned.
+	 */
+	alloc_t Colors = 1;
+	alloc_t ColorStep = 0;
+
+	if(Info->CacheColors > 1)
+	{
+		AssertEQ(ALLOC_IS_POWER_OF_2(Info->CacheColors), 1);
+
+		Colors = Info->CacheColors;
+
+		if(HeaderOffset)
+		{
+			ColorStep = ALLOC_CACHE_LINE_SIZE;
+			Colors = ALLOC_MIN(Colors,
+				(AllocPageSize - HeaderSize) / ColorStep + 1);
+		}
+		else
+		{
+			ColorStep = ALLOC_MAX(ALLOC_CACHE_LINE_SIZE, Info->Alignment);
+		}
+
+		Colors = UINT32_C(1) << (31 - __builtin_clz(Colors));
+	}
+
+	alloc_t DataOffset = Padding - HeaderOffset;
+	alloc_t ColorSpan = HeaderOffset ? 0 : (Colors - 1) * ColorStep;
+
+	alloc_t AllocLimit = BlockSize > DataOffset + ColorSpan ?
+		(BlockSize - DataOffset - ColorSpan) / Info->AllocSize : 0;
+	AllocLimit = ALLOC_MIN(AllocLimit, AllocLimitMax[TableIndex]);
+
+	if(Bitmap)
+	{
+		AllocLimit = ALLOC_MIN(AllocLimit, BitmapLimit);
+	}
+
+	AllocLimit = ALLOC_MAX(AllocLimit, 1U);
+
+	BlockSize = DataOffset + ColorSpan + AllocLimit * Info->AllocSize;
+	BlockSize = AllocGetNextPO2(BlockSize);
+
+	HandleInternal->Padding = Padding;
+	HandleInternal->AllocLimit = AllocLimit;
+	HandleInternal->AllocSize = Info->AllocSize;
+	HandleInternal->BlockSize = BlockSize;
+	HandleInternal->HeaderOffset = HeaderOffset;
+
+	HandleInternal->ColorMask = Colors - 1;
+	HandleInternal->ColorStep = ColorStep;
+
+	if(HeaderOffset)
+	{
+		HandleInternal->DataMask = ~(BlockSize - 1);
+	}
+
+	/* Nursery slots must fit at least one object. Out-of-line headers would
+	 * need a page in between the slots, so they do not grow geometrically.
+	 */
+	if(
+		TableIndex == 3 && !HeaderOffset &&
+		Info->InitialBlockSize && !Region
+		)
+	{
+		alloc_t NurseryMin = ALLOC_MAX(Info->InitialBlockSize,
+			DataOffset + ColorSpan + Info->AllocSize);
+		NurseryMin = ALLOC_MAX(NurseryMin, AllocPageSize);
+		NurseryMin = AllocGetNextPO2(NurseryMin);
+
+		if(NurseryMin < BlockSize)
+		{
+			HandleInternal->NurseryMin = NurseryMin;
+			HandleInternal->NurserySlots =
+				AllocLog2(BlockSize) - AllocLog2(NurseryMin) + 1;
+		}
+	}
+
+	AllocInitHandleDivision(HandleInternal);
+
+	HandleInternal->Engine = Bitmap ? 4 : TableIndex;
+}
+
+
+void
+AllocCreateHandle(
+	_in_ AllocHandleInfo* Info,
+	_opaque_ AllocHandle* Handle
+	)
+{
+	AllocInitHandle(Info, Handle, NULL);
+}
+
+
+void
+AllocCloneHandle(
+	_opaque_ AllocHandle* Source,
+	_opaque_ AllocHandle* Handle
+	)
+{
+	AllocHandleInternal* SourceInternal = (void*) Source;
+
+	if(AllocHandleIsVirtual(SourceInternal))
+	{
+		AllocCreateHandle(NULL, Handle);
+	}
+	else
+	{
+		AllocCreateHandle(&SourceInternal->Info, Handle);
+	}
+}
+
+
+void
+AllocDestroyHandle(
+	_opaque_ AllocHandle* Handle
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+
+	AllocHandleResetUH(Handle);
+
+#if ALLOC_THREADS == 1
+	AllocMutexDestroy(&HandleInternal->Mutex);
+#endif
+}
+
+
+Static uint32_t
+AllocDefaultIndexFunc(
+	alloc_t Size
+	)
+{
+	return AllocLog2(AllocGetNextPO2(Size));
+}
+
+
+/* I/O states only have handles from a page up.
+ */
+Static uint32_t
+AllocIoIndexFunc(
+	alloc_t Size
+	)
+{
+	uint32_t Index = AllocDefaultIndexFunc(Size);
+
+	return Index > AllocPageSizeShift ? Index - AllocPageSizeShift : 0;
+}
+
+
+uint32_t
+AllocFineIndexFunc(
+	alloc_t Size
+	)
+{
+	if(Size <= 8)
+	{
+		return AllocDefaultIndexFunc(Size);
+	}
+
+	/* The top bit picks the doubling, the 2 bits below it the quarter.
+	 */
+	alloc_t Last = AllocFineRoundSize(Size) - 1;
+	uint32_t Shift = AllocLog2Floor(Last) - 2;
+
+	return Shift * 4 + ((Last >> Shift) & 3);
+}
+
+
+_const_func_ const AllocStateInfo*
+AllocGetFineStateInfo(
+	void
+	)
+{
+	return &AllocFineStateInfo;
+}
+
+
+Static void
+AllocInitSmallIndex(
+	AllocState* State
+	)
+{
+	AllocIndexFunc IndexFunc = State->IndexFunc ?
+		State->IndexFunc : AllocDefaultIndexFunc;
+
+	for(alloc_t i = 0; i < ALLOC_ARRAYLEN(State->SmallIndex); ++i)
+	{
+		alloc_t Size = (i << ALLOC_SMALL_INDEX_SHIFT) + 1;
+		alloc_t End = (i + 1) << ALLOC_SMALL_INDEX_SHIFT;
+
+		uint32_t Index = IndexFunc(Size);
+
+		while(++Size <= End)
+		{
+			if(IndexFunc(Size) != Index)
+			{
+				Index = ALLOC_SMALL_INDEX_NONE;
+				break;
+			}
+		}
+
+		if(Index != ALLOC_SMALL_INDEX_NONE)
+		{
+			Index = ALLOC_MIN(Index, State->HandleCount - 1);
+			Index = ALLOC_MIN(Index, (uint32_t) ALLOC_SMALL_INDEX_NONE);
+		}
+
+		State->SmallIndex[i] = Index;
+	}
+}
+
+
+_alloc_func_ const AllocState*
+AllocAllocState(
+	_in_ AllocStateInfo* Info
+	)
+{
+	if(!Info)
+	{
+		Info = &AllocDefaultStateInfo;
+	}
+
+
+	alloc_t HandleCount = Info->HandleCount + 1;
+	AllocState* State = AllocAllocVirtual(
+		sizeof(AllocState) + sizeof(AllocHandle) * HandleCount);
+	if(!State)
+	{
+		return NULL;
+	}
+
+	if(!Info->IndexFunc)
+	{
+		State->IndexFunc = AllocDefaultIndexFunc;
+	}
+	else
+	{
+		State->IndexFunc = Info->IndexFunc;
+	}
+
+	State->HandleCount = HandleCount;
+
+	AllocInitSmallIndex(State);
+
+
+	AllocHandleInfo* HandleInfo = Info->Handles;
+	AllocHandleInfo* HandleInfoEnd = HandleInfo + Info->HandleCount;
+
+	alloc_t i = 0;
+
+	for(; HandleInfo < HandleInfoEnd; ++HandleInfo, ++i)
+	{
+		AllocCreateHandle(HandleInfo, &State->Handles[i]);
+	}
+
+	if(Info->ExtentSizeMax)
+	{
+		AllocHandleInfo ExtentInfo =
+		(AllocHandleInfo)
+		{
+			.AllocSize = Info->ExtentSizeMax,
+			.BlockSize = ALLOC_DEFAULT_EXTENT_BLOCK_SIZE,
+			.Alignment = 1,
+			.Type = ALLOC_HANDLE_TYPE_EXTENT
+		};
+
+		AllocCreateHandle(&ExtentInfo, &State->Handles[i]);
+	}
+	else
+	{
+		AllocCreateHandle(NULL, &State->Handles[i]);
+	}
+
+
+	return State;
+}
+
+
+_alloc_func_ const AllocState*
+AllocCloneState(
+	_in_ AllocState* Source
+	)
+{
+	alloc_t HandleCount = Source->HandleCount;
+	alloc_t TotalSize = sizeof(AllocState) + sizeof(AllocHandle) * HandleCount;
+
+	AllocState* State = AllocAllocVirtual(TotalSize);
+	if(!State)
+	{
+		return NULL;
+	}
+
+	State->IndexFunc = Source->IndexFunc;
+	State->HandleCount = HandleCount;
+
+	(void) memcpy(State->SmallIndex, Source->SmallIndex,
+		sizeof(State->SmallIndex));
+
+	for(alloc_t i = 0; i < HandleCount; ++i)
+	{
+		AllocCloneHandle(&Source->Handles[i], &State->Handles[i]);
+	}
+
+	return State;
+}
+
+
+#ifdef __linux__
+
+
+/* Reinitializes the locks of a region that was just mapped. They might have
+ * been left locked by a process that no longer exists.
+ */
+Static void
+AllocRegionResetLocks(
+	AllocRegion* Region
+	)
+{
+#if ALLOC_THREADS == 1
+	AllocMutexInitShared(&Region->Mutex);
+
+	alloc_t HandleCount = Region->State->HandleCount;
+
+	for(alloc_t i = 0; i < HandleCount; ++i)
+	{
+		AllocHandleInternal* HandleInternal =
+			(void*) &Region->State->Handles[i];
+		AllocMutexInitShared(&HandleInternal->Mutex);
+	}
+#else
+	(void) Region;
+#endif
+}
+
+
+/* Maps `Fd` at `Base`, or anywhere if `NULL`, and builds a state in it.
+ * A negative `Fd` makes a private region.
+ */
+Static const AllocState*
+AllocCreateRegionState(
+	int Fd,
+	void* Base,
+	_in_ AllocStateInfo* Info,
+	alloc_t Size,
+	alloc_t Flags
+	)
+{
+	if(!Info)
+	{
+		Info = &AllocDefaultStateInfo;
+	}
+
+	/* The index function would not be valid in other processes.
+	 */
+	if(Info->IndexFunc)
+	{
+		return NULL;
+	}
+
+	alloc_t HandleCount = Info->HandleCount + 1;
+	alloc_t StateOffset = (sizeof(AllocRegion) + ALLOC_CACHE_LINE_SIZE - 1) &
+		~(alloc_t) (ALLOC_CACHE_LINE_SIZE - 1);
+	alloc_t HeaderSize = StateOffset +
+		sizeof(AllocState) + sizeof(AllocHandle) * HandleCount;
+	HeaderSize = (HeaderSize + AllocPageSizeMask) & ~AllocPageSizeMask;
+
+	Size = (Size + AllocPageSizeMask) & ~AllocPageSizeMask;
+	if(Size <= HeaderSize || (Fd >= 0 && ftruncate(Fd, Size)))
+	{
+		return NULL;
+	}
+
+	AllocRegion* Region;
+
+	if(Base)
+	{
+		Region = mmap(Base, Size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED_NOREPLACE, Fd, 0);
+		if(Region == MAP_FAILED)
+		{
+			return NULL;
+		}
+
+		if(Region != Base)
+		{
+			AllocFreeVirtual(Region, Size);
+			return NULL;
+		}
+	}
+	else
+	{
+		Region = AllocMapRegion(Fd, Size, ALLOC_REGION_ALIGNMENT);
+		if(!Region)
+		{
+			return NULL;
+		}
+	}
+
+	Region->Version = ALLOC_REGION_VERSION;
+	Region->Layout = ALLOC_REGION_LAYOUT;
+	Region->Base = (uintptr_t) Region;
+	Region->Size = Size;
+	Region->Used = HeaderSize;
+	Region->Flags = Flags | (Fd < 0 ? ALLOC_REGION_FLAG_PRIVATE : 0);
+
+	/* Fault the whole region in and keep it there, so that nothing after
+	 * this ever has to ask the system for anything.
+	 */
+	if((Flags & ALLOC_REGION_FLAG_LOCKED) && mlock(Region, Size))
+	{
+		AllocFreeVirtual(Region, Size);
+		return NULL;
+	}
+
+	AllocState* State = (void*) ((uint8_t*) Region + StateOffset);
+	State->IndexFunc = NULL;
+	State->HandleCount = HandleCount;
+
+	AllocInitSmallIndex(State);
+
+	for(alloc_t i = 0; i < HandleCount; ++i)
+	{
+		AllocInitHandle(i < Info->HandleCount ? &Info->Handles[i] : NULL,
+			&State->Handles[i], Region);
+
+#if ALLOC_THREADS == 1
+		AllocHandleInternal* HandleInternal = (void*) &State->Handles[i];
+		AllocMutexDestroy(&HandleInternal->Mutex);
+#endif
+	}
+
+	Region->State = State;
+
+	AllocRegionResetLocks(Region);
+
+	__atomic_store_n(&Region->Magic, ALLOC_REGION_MAGIC, __ATOMIC_RELEASE);
+
+	return State;
+}
+
+
+/* Maps the region of `Fd` at the address it was created at. Returns `NULL` if
+ * that is not possible, or if `Fd` does not hold a region.
+ */
+Static const AllocState*
+AllocMapRegionState(
+	int Fd,
+	int ResetLocks
+	)
+{
+	AllocRegion Header;
+
+	if(
+		pread(Fd, &Header, sizeof(Header), 0) != sizeof(Header) ||
+		Header.Magic != ALLOC_REGION_MAGIC ||
+		Header.Version != ALLOC_REGION_VERSION ||
+		Header.Layout != ALLOC_REGION_LAYOUT
+		)
+	{
+		return NULL;
+	}
+
+	/* Without `MAP_FIXED_NOREPLACE`, the address is only a hint.
+	 */
+	AllocRegion* Region = mmap((void*) Header.Base, Header.Size,
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, Fd, 0);
+	if(Region == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	if(Region != (void*) Header.Base)
+	{
+		AllocFreeVirtual(Region, Header.Size);
+		return NULL;
+	}
+
+	if(ResetLocks)
+	{
+		AllocRegionResetLocks(Region);
+	}
+
+	return Region->State;
+}
+
+
+#endif /* __linux__ */
+
+
+_alloc_func_ const AllocState*
+AllocAllocSharedState(
+	_in_ AllocStateInfo* Info,
+	alloc_t Size,
+	_out_ int* Fd
+	)
+{
+#ifdef __linux__
+	int RegionFd = memfd_create("alloc", MFD_CLOEXEC);
+	if(RegionFd < 0)
+	{
+		return NULL;
+	}
+
+	const AllocState* State =
+		AllocCreateRegionState(RegionFd, NULL, Info, Size, 0);
+	if(!State)
+	{
+		(void) close(RegionFd);
+		return NULL;
+	}
+
+	*Fd = RegionFd;
+	return State;
+#else
+	(void) Info;
+	(void) Size;
+	(void) Fd;
+
+	return NULL;
+#endif
+}
+
+
+const AllocState*
+AllocAttachSharedState(
+	int Fd
+	)
+{
+#ifdef __linux__
+	return AllocMapRegionState(Fd, 0);
+#else
+	(void) Fd;
+
+	return NULL;
+#endif
+}
+
+
+_alloc_func_ const AllocState*
+AllocOpenPersistentState(
+	_in_ char* Path,
+	_in_ AllocStateInfo* Info,
+	alloc_t Size,
+	_opaque_ void* Base
+	)
+{
+#ifdef __linux__
+	int Fd = open(Path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if(Fd < 0)
+	{
+		return NULL;
+	}
+
+	const AllocState* State;
+	struct stat Stat;
+	uint64_t Magic = 0;
+
+	if(fstat(Fd, &Stat))
+	{
+		State = NULL;
+	}
+	else if(Stat.st_size &&
+		(pread(Fd, &Magic, sizeof(Magic), 0) != sizeof(Magic) || Magic))
+	{
+		/* Whoever had the file open before is gone, and so are their locks.
+		 */
+		State = AllocMapRegionState(Fd, 1);
+	}
+	else
+	{
+		/* That includes a file that was sized, but then never got its magic
+		 * number, because the process died while creating the state.
+		 */
+		State = AllocCreateRegionState(Fd, (void*) Base, Info, Size, 0);
+	}
+
+	/* The mapping keeps the file alive.
+	 */
+	(void) close(Fd);
+
+	return State;
+#else
+	(void) Path;
+	(void) Info;
+	(void) Size;
+	(void) Base;
+
+	return NULL;
+#endif
+}
+
+
+_alloc_func_ const AllocState*
+AllocAllocRealtimeState(
+	_in_ AllocStateInfo* Info,
+	alloc_t Size
+	)
+{
+#ifdef __linux__
+	return AllocCreateRegionState(-1, NULL, Info, Size,
+		ALLOC_REGION_FLAG_DIRTY | ALLOC_REGION_FLAG_LOCKED);
+#else
+	(void) Info;
+	(void) Size;
+
+	return NULL;
+#endif
+}
+
+
+_alloc_func_ const AllocState*
+AllocAllocCompactState(
+	_in_ AllocStateInfo* Info,
+	alloc_t Size
+	)
+{
+#ifdef __linux__
+	if((uint64_t) Size > ALLOC_COMPACT_SIZE_MAX)
+	{
+		return NULL;
+	}
+
+	/* The region is only reserved, pages are committed as they are touched.
+	 */
+	return AllocCreateRegionState(-1, NULL, Info, Size,
+		ALLOC_REGION_FLAG_COMPACT);
+#else
+	(void) Info;
+	(void) Size;
+
+	return NULL;
+#endif
+}
+
+
+_alloc_func_ const AllocState*
+AllocAllocIoState(
+	alloc_t Size
+	)
+{
+#ifdef __linux__
+	/* Every size is rounded up to a page, so that buffers are whole pages.
+	 * The header of a block takes its first page, so that no data page ever
+	 * has anything but buffers in it.
+	 */
+	AllocHandleInfo Handles[ALLOC_IO_SIZE_MAX_SHIFT + 1];
+	alloc_t HandleCount = ALLOC_IO_SIZE_MAX_SHIFT + 1 - AllocPageSizeShift;
+
+	for(alloc_t i = 0; i < HandleCount; ++i)
+	{
+		Handles[i] = (AllocHandleInfo)
+		{
+			.AllocSize = AllocPageSize << i,
+			.BlockSize = ALLOC_DEFAULT_BLOCK_SIZE,
+			.Alignment = AllocPageSize
+		};
+	}
+
+	AllocStateInfo Info =
+	{
+		.Handles = Handles,
+		.HandleCount = HandleCount,
+		.IndexFunc = NULL
+	};
+
+	/* Buffers might be registered with the kernel, which pins their pages.
+	 * Purging them would replace the pages under the registration.
+	 */
+	AllocState* State = (void*) AllocCreateRegionState(-1, NULL, &Info, Size,
+		ALLOC_REGION_FLAG_DIRTY);
+	if(!State)
+	{
+		return NULL;
+	}
+
+	/* The region is private to this process, so unlike in shared regions,
+	 * a function pointer stays valid.
+	 */
+	State->IndexFunc = AllocIoIndexFunc;
+	AllocInitSmallIndex(State);
+
+	return State;
+#else
+	(void) Size;
+
+	return NULL;
+#endif
+}
+
+
+int
+AllocGetRangeS(
+	_in_ AllocState* State,
+	_out_ void** Base,
+	_out_ alloc_t* Size
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) &State->Handles[0];
+	AllocRegion* Region = HandleInternal->Region;
+
+	if(!Region)
+	{
+		return 0;
+	}
+
+	*Base = (void*) Region->Base;
+	*Size = Region->Size;
+
+	return 1;
+}
+
+
+int
+AllocGetRangePartS(
+	_in_ AllocState* State,
+	alloc_t Index,
+	_out_ void** Base,
+	_out_ alloc_t* Size
+	)
+{
+	void* RangeBase;
+	alloc_t RangeSize;
+
+	if(!AllocGetRangeS(State, &RangeBase, &RangeSize))
+	{
+		return 0;
+	}
+
+	/* Parts are cut at multiples of their size in the address space.
+	 */
+	uintptr_t Start = (uintptr_t) RangeBase;
+	uintptr_t End = Start + RangeSize;
+	uintptr_t First = Start & ~(uintptr_t) (ALLOC_RANGE_PART_SIZE - 1);
+
+	if(Index >= (End - First - 1) / ALLOC_RANGE_PART_SIZE + 1)
+	{
+		return 0;
+	}
+
+	uintptr_t PartStart = ALLOC_MAX(First + Index * ALLOC_RANGE_PART_SIZE,
+		Start);
+
+	*Base = (void*) PartStart;
+	*Size = ALLOC_MIN(End - PartStart, ALLOC_RANGE_PART_SIZE -
+		(PartStart & (ALLOC_RANGE_PART_SIZE - 1)));
+
+	return 1;
+}
+
+
+_pure_func_ alloc_t
+AllocGetSyscallCountS(
+	_in_ AllocState* State
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) &State->Handles[0];
+	if(!HandleInternal->Region)
+	{
+		return 0;
+	}
+
+	return __atomic_load_n(&HandleInternal->Region->Syscalls, __ATOMIC_RELAXED);
+}
+
+
+void
+AllocSetRootS(
+	_in_ AllocState* State,
+	_opaque_ void* Root
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) &State->Handles[0];
+	AssertNEQ(HandleInternal->Region, NULL);
+
+	HandleInternal->Region->Root = (void*) Root;
+}
+
+
+_pure_func_ void*
+AllocGetRootS(
+	_in_ AllocState* State
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) &State->Handles[0];
+	AssertNEQ(HandleInternal->Region, NULL);
+
+	return HandleInternal->Region->Root;
+}
+
+
+int
+AllocSyncS(
+	_in_ AllocState* State
+	)
+{
+#ifdef __linux__
+	AllocHandleInternal* HandleInternal = (void*) &State->Handles[0];
+	AllocRegion* Region = HandleInternal->Region;
+	if(!Region)
+	{
+		return 0;
+	}
+
+	return !msync(Region, Region->Size, MS_SYNC);
+#else
+	(void) State;
+
+	return 0;
+#endif
+}
+
+
+uint32_t
+AllocAllocCompactH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+	AllocRegion* Region = HandleInternal->Region;
+
+	AssertNEQ(Region, NULL);
+	AssertNEQ((Region->Flags & ALLOC_REGION_FLAG_COMPACT), 0);
+
+	void* Ptr = AllocAllocH(Handle, Size, Zero);
+	if(!Ptr)
+	{
+		return 0;
+	}
+
+	/* Objects are aligned to at least their size, so this only fails for
+	 * handles of less than `ALLOC_COMPACT_SIZE_MIN` bytes.
+	 */
+	if((uintptr_t) Ptr & (ALLOC_COMPACT_SIZE_MIN - 1))
+	{
+		AllocFreeH(Handle, Ptr, Size);
+		return 0;
+	}
+
+	return ((uintptr_t) Ptr - (uintptr_t) Region->State) >> ALLOC_COMPACT_SHIFT;
+}
+
+
+void
+AllocFreeCompactH(
+	_opaque_ AllocHandle* Handle,
+	uint32_t Ref,
+	alloc_t Size
+	)
+{
+	if(!Ref)
+	{
+		return;
+	}
+
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+	AllocRegion* Region = HandleInternal->Region;
+
+	AssertNEQ(Region, NULL);
+
+	AllocFreeH(Handle, (uint8_t*) Region->State +
+		((uintptr_t) Ref << ALLOC_COMPACT_SHIFT), Size);
+}
+
+
+void
+AllocFreeState(
+	_opaque_ AllocState* State
+	)
+{
+	if(!State)
+	{
+		State = AllocGlobalState;
+	}
+
+	AllocUnregisterState(State);
+
+#ifdef __linux__
+	AllocHandleInternal* HandleInternal = (void*) &State->Handles[0];
+	AllocRegion* Region = HandleInternal->Region;
+
+	/* Other processes might still be using the handles. The memory itself is
+	 * released once no process has the region mapped nor open.
+	 */
+	if(Region)
+	{
+		AllocFreeVirtual(Region, Region->Size);
+		return;
+	}
+#endif
+
+
+	alloc_t i = 0;
+	alloc_t HandleCount = State->HandleCount;
+
+	for(; i < HandleCount; ++i)
+	{
+		AllocDestroyHandle(&State->Handles[i]);
+	}
+
+	AllocFreeVirtual(State, sizeof(AllocState) +
+		HandleCount * sizeof(AllocHandle));
+}
+
+
+_pure_func_ _opaque_ AllocHandle*
+AllocGetHandleS(
+	_in_ AllocState* State,
+	alloc_t Size
+	)
+{
+	if(Size == 0)
+	{
+		/* No functions use a handle when size is 0 */
+		return NULL;
+	}
+
+	if(Size <= ALLOC_SMALL_INDEX_MAX)
+	{
+		uint8_t Small =
+			State->SmallIndex[(Size - 1) >> ALLOC_SMALL_INDEX_SHIFT];
+
+		if(Small != ALLOC_SMALL_INDEX_NONE)
+		{
+			return &State->Handles[Small];
+		}
+	}
+
+	uint32_t Index = State->IndexFunc ?
+		State->IndexFunc(Size) : AllocDefaultIndexFunc(Size);
+	Index = ALLOC_MIN(Index, State->HandleCount - 1);
+
+	return &State->Handles[Index];
+}
+
+
+void
+AllocHandleLockH(
+	_opaque_ AllocHandle* Handle
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+
+	ALLOC_LOCK(&HandleInternal->Mutex);
+}
+
+
+void
+AllocHandleUnlockH(
+	_opaque_ AllocHandle* Handle
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+
+	ALLOC_UNLOCK(&HandleInternal->Mutex);
+}
+
+
+void
+AllocHandleSetFlagsH(
+	_opaque_ AllocHandle* Handle,
+	AllocHandleFlag Flags
+	)
+{
+	AllocHandleLockH(Handle);
+		AllocHandleSetFlagsUH(Handle, Flags);
+	AllocHandleUnlockH(Handle);
+}
+
+
+void
+AllocHandleSetFlagsUH(
+	_opaque_ AllocHandle* Handle,
+	AllocHandleFlag Flags
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+
+	HandleInternal->Flags = Flags;
+}
+
+
+void
+AllocHandleAddFlagsH(
+	_opaque_ AllocHandle* Handle,
+	AllocHandleFlag Flags
+	)
+{
+	AllocHandleLockH(Handle);
+		AllocHandleAddFlagsUH(Handle, Flags);
+	AllocHandleUnlockH(Handle);
+}
+
+
+void
+AllocHandleAddFlagsUH(
+	_opaque_ AllocHandle* Handle,
+	AllocHandleFlag Flags
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+
+	HandleInternal->Flags |= Flags;
+}
+
+
+void
+AllocHandleDelFlagsH(
+	_opaque_ AllocHandle* Handle,
+	AllocHandleFlag Flags
+	)
+{
+	AllocHandleLockH(Handle);
+		AllocHandleDelFlagsUH(Handle, Flags);
+	AllocHandleUnlockH(Handle);
+}
+
+
+void
+AllocHandleDelFlagsUH(
+	_opaque_ AllocHandle* Handle,
+	AllocHandleFlag Flags
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+
+	HandleInternal->Flags &= ~Flags;
+}
+
+
+AllocHandleFlag
+AllocHandleGetFlagsH(
+	_opaque_ AllocHandle* Handle
+	)
+{
+	AllocHandleFlag Flags;
+
+	AllocHandleLockH(Handle);
+		Flags = AllocHandleGetFlagsUH(Handle);
+	AllocHandleUnlockH(Handle);
+
+	return Flags;
+}
+
+
+AllocHandleFlag
+AllocHandleGetFlagsUH(
+	_opaque_ AllocHandle* Handle
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+
+	return HandleInternal->Flags;
+}
+
+
+void
+AllocHandleSetSpareH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Spare
+	)
+{
+	AllocHandleLockH(Handle);
+		AllocHandleSetSpareUH(Handle, Spare);
+	AllocHandleUnlockH(Handle);
+}
+
+
+/* The handle's own count is kept in `Info`, so that the reclaim agent knows
+ * to leave it alone, and clones get it too.
+ */
+void
+AllocHandleSetSpareUH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Spare
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+
+	HandleInternal->Info.Spare = Spare;
+	HandleInternal->Spare =
+		Spare ? AllocResolveSpare(Spare) : ALLOC_DEFAULT_SPARE;
+}
+
+
+alloc_t
+AllocHandleGetSpareH(
+	_opaque_ AllocHandle* Handle
+	)
+{
+	alloc_t Spare;
+
+	AllocHandleLockH(Handle);
+		Spare = AllocHandleGetSpareUH(Handle);
+	AllocHandleUnlockH(Handle);
+
+	return Spare;
+}
+
+
+alloc_t
+AllocHandleGetSpareUH(
+	_opaque_ AllocHandle* Handle
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+
+	return HandleInternal->Spare;
+}
+
+
+Static void*
+GetBasePtr(
+	AllocHandleInternal* Handle,
+	_in_ void* Ptr
+	)
+{
+	if(AllocHandleIsVirtual(Handle))
+	{
+		return (void*) Ptr;
+	}
+
+	return AllocGetBlockHeader(Handle, AllocGetBlockBase(Handle, Ptr));
+}
+
+
+_alloc_func_ void*
+AllocAllocH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	if(!Size)
+	{
+		return NULL;
+	}
+
+	void* Ptr;
+
+	AllocHandleLockH(Handle);
+		Ptr = AllocAllocUH(Handle, Size, Zero);
+	AllocHandleUnlockH(Handle);
+
+	return Ptr;
+}
+
+
+_alloc_func_ void*
+AllocAllocUH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Size,
+	int Zero
+	)
+{
+	if(!Size)
+	{
+		return NULL;
+	}
+
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+
+	return AllocAllocFuncs[HandleInternal->Engine](HandleInternal, Size, Zero);
+}
+
+
+void
+AllocFreeH(
+	_opaque_ AllocHandle* Handle,
+	_opaque_ void* Ptr,
+	alloc_t Size
+	)
+{
+	if(!Size)
+	{
+		return;
+	}
+
+	AllocHandleLockH(Handle);
+		AllocFreeUH(Handle, Ptr, Size);
+	AllocHandleUnlockH(Handle);
+}
+
+
+void
+AllocFreeUH(
+	_opaque_ AllocHandle* Handle,
+	_opaque_ void* Ptr,
+	alloc_t Size
+	)
+{
+	if(!Size)
+	{
+		return;
+	}
+
+	AllocHandleInternal* HandleInternal = (void*) Handle;
+
+	AllocFreeFuncs[HandleInternal->Engine](HandleInternal,
+		GetBasePtr(HandleInternal, Ptr), (void*) Ptr, Size);
+}
+
+
+/* Whether objects of `Size` bytes get their own virtual memory.
+ */
+Static int
+AllocIsVirtualSize(
+	AllocHandleInternal* Handle,
+	alloc_t Size
+	)
+{
+	return AllocHandleIsVirtual(Handle) ||
+		(Handle->Engine == 5 && Size > Handle->AllocSize);
+}
+
+
+/* Objects of fixed size handles have room for any size up to `AllocSize`.
+ * Extents only have room for their own number of pages, buddies for their
+ * own level, and arena objects for their own size. Stacks are left to
+ * `AllocResizeStack`, since they have to move `Used` under the lock.
+ */
+Static int
+AllocCanResizeInPlace(
+	AllocHandleInternal* Handle,
+	alloc_t OldSize,
+	alloc_t NewSize
+	)
+{
+	if(AllocHandleIsVirtual(Handle))
+	{
+		return 0;
+	}
+
+	if(Handle->Engine == 7)
+	{
+		return NewSize <= OldSize;
+	}
+
+	if(Handle->Engine == 6)
+	{
+		return AllocGetBuddyLevel(Handle, OldSize) ==
+			AllocGetBuddyLevel(Handle, NewSize);
+	}
+
+	if(Handle->Engine != 5)
+	{
+		return Handle->Engine != 8;
+	}
+
+	return OldSize <= Handle->AllocSize && NewSize <= Handle->AllocSize &&
+		((OldSize + AllocPageSizeMask) >> AllocPageSizeShift) ==
+		((NewSize + AllocPageSizeMask) >> AllocPageSizeShift);
+}
+
+
+/* The most recent object of a stack is resized in place for as long as it
+ * fits in its block, and `Used` follows its end, so that it can still be
+ * freed. Any other object can only shrink, and what it gives up is freed
+ * with it when the stack is restored. Returns whether `Ptr` stays.
+ */
+Static int
+AllocResizeStack(
+	AllocHandleInternal* Handle,
+	void* Ptr,
+	alloc_t OldSize,
+	alloc_t NewSize,
+	int Zero
+	)
+{
+	AllocArena* Block = GetBasePtr(Handle, Ptr);
+	alloc_t Offset = (uint8_t*) Ptr - (uint8_t*) Block;
+
+	if(Block != (void*) Handle->Head || Offset + OldSize != Block->Used)
+	{
+		return NewSize <= OldSize;
+	}
+
+	if(Offset + NewSize > Handle->BlockSize)
+	{
+		return 0;
+	}
+
+	Handle->Allocations += NewSize;
+	Handle->Allocations -= OldSize;
+	Block->Used = Offset + NewSize;
+
+	if(NewSize > OldSize && Zero)
+	{
+		(void) memset((uint8_t*) Ptr + OldSize, 0, NewSize - OldSize);
+	}
+
+	return 1;
+}
+
+
+void*
+AllocReallocH(
+	_opaque_ AllocHandle* OldHandle,
+	_opaque_ void* Ptr,
+	alloc_t OldSize,
+	_opaque_ AllocHandle* NewHandle,
+	alloc_t NewSize,
+	int Zero
+	)
+{
+	if(!NewSize)
+	{
+		AllocFreeH(OldHandle, Ptr, OldSize);
+		return NULL;
+	}
+
+	if(!Ptr)
+	{
+		return AllocAllocH(NewHandle, NewSize, Zero);
+	}
+
+	if(OldHandle == NewHandle)
+	{
+		AllocHandleInternal* HandleInternal = (void*) OldHandle;
+
+		if(AllocCanResizeInPlace(HandleInternal, OldSize, NewSize))
+		{
+			if(NewSize > OldSize && Zero)
+			{
+				(void) memset((uint8_t*) Ptr + OldSize, 0, NewSize - OldSize);
+			}
+
+			return (void*) Ptr;
+		}
+
+		if(HandleInternal->Engine == 8)
+		{
+			int Resized;
+
+			AllocHandleLockH(OldHandle);
+				Resized = AllocResizeStack(HandleInternal, (void*) Ptr,
+					OldSize, NewSize, Zero);
+			AllocHandleUnlockH(OldHandle);
+
+			if(Resized)
+			{
+				return (void*) Ptr;
+			}
+		}
+
+		/* Shared virtual memory is moved like any other.
+		 */
+		if(
+			AllocIsVirtualSize(HandleInternal, OldSize) &&
+			AllocIsVirtualSize(HandleInternal, NewSize) &&
+			!HandleInternal->Region
+			)
+		{
+			void* NewPtr;
+
+			AllocHandleLockH(OldHandle);
+				NewPtr = AllocReallocVirtualFunc(HandleInternal, (void*) Ptr,
+					OldSize, NewSize);
+			AllocHandleUnlockH(OldHandle);
+
+			return NewPtr;
+		}
+	}
+
+	void* NewPtr = AllocAllocH(NewHandle, NewSize, Zero);
+	if(!NewPtr)
+	{
+		return NULL;
+	}
+
+	(void) memcpy(NewPtr, Ptr, ALLOC_MIN(OldSize, NewSize));
+
+	AllocFreeH(OldHandle, Ptr, OldSize);
+
+	return NewPtr;
+}
+
+
+void*
+AllocReallocUH(
+	_opaque_ AllocHandle* OldHandle,
+	_opaque_ void* Ptr,
+	alloc_t OldSize,
+	_opaque_ AllocHandle* NewHandle,
+	alloc_t NewSize,
+	int Zero
+	)
+{
+	if(!NewSize)
+	{
+		AllocFreeUH(OldHandle, Ptr, OldSize);
+		return NULL;
+	}
+
+	if(!Ptr)
+	{
+		return AllocAllocUH(NewHandle, NewSize, Zero);
+	}
+
+	if(OldHandle == NewHandle)
+	{
+		AllocHandleInternal* HandleInternal = (void*) OldHandle;
+
+		if(AllocCanResizeInPlace(HandleInternal, OldSize, NewSize))
+		{
+			if(NewSize > OldSize && Zero)
+			{
+				(void) memset((uint8_t*) Ptr + OldSize, 0, NewSize - OldSize);
+			}
+
+			return (void*) Ptr;
+		}
+
+		if(
+			HandleInternal->Engine == 8 &&
+			AllocResizeStack(HandleInternal, (void*) Ptr, OldSize, NewSize,
+				Zero)
+			)
+		{
+			return (void*) Ptr;
+		}
 
-		if(Zero)
+		/* Shared virtual memory is moved like any other.
+		 */
+		if(
+			AllocIsVirtualSize(HandleInternal, OldSize) &&
+			AllocIsVirtualSize(HandleInternal, NewSize) &&
+			!HandleInternal->Region
+			)
 		{
-			(void) memset(Ptr, 0, 2);
+			return AllocReallocVirtualFunc(HandleInternal, (void*) Ptr,
+				OldSize, NewSize);
 		}
+	}
 
-		return Ptr;
+	void* NewPtr = AllocAllocUH(NewHandle, NewSize, Zero);
+	if(!NewPtr)
+	{
+		return NULL;
 	}
 
-	return Data + Alloc->Used++ * 2;
+	(void) memcpy(NewPtr, Ptr, ALLOC_MIN(OldSize, NewSize));
+
+	AllocFreeUH(OldHandle, Ptr, OldSize);
+
+	return NewPtr;
 }
 
 
-Static void
-AllocFree2Func(
-	AllocHandleInternal* Handle,
-	void* BlockPtr,
-	void* Ptr,
-	alloc_t Size
-	)
-{
-	(void) Size;
+/* RECLAMATION
+ */
 
-	Alloc2* Alloc = BlockPtr;
 
-	--Handle->Allocations;
-	--Alloc->Count;
 
-	if(
-		Alloc->Count == 0 &&
-		(
-			(Handle->Flags & ALLOC_HANDLE_FLAG_IMMEDIATE_FREE) ||
-			(
-				Handle->Allocators >= 2 &&
-				!(Handle->Flags & ALLOC_HANDLE_FLAG_DO_NOT_FREE) &&
-				Handle->Allocations <=
-					Handle->AllocLimit * (Handle->Allocators - 2)
-			)
-		)
-		)
+/* Returns the number of objects allocated from a block.
+ */
+Static alloc_t
+AllocGetBlockCount(
+	AllocHandleInternal* Handle,
+	AllocBlock* Block
+	)
+{
+	switch(Handle->Engine)
 	{
-		if(Alloc->Prev)
-		{
-			Alloc->Prev->Next = Alloc->Next;
-		}
-		else
-		{
-			Handle->Head = (void*) Alloc->Next;
-		}
-
-		if(Alloc->Next)
-		{
-			Alloc->Next->Prev = Alloc->Prev;
-		}
 
-		AllocFreeVirtualAligned(Alloc->RealPtr,
-			Handle->BlockSize, Handle->BlockSize);
+	case 1: return ((Alloc1Block*) Block)->Count;
+	case 2: return ((Alloc2*) Block)->Count;
+	case 3: return ((Alloc4*) Block)->Count;
+	case 4: return ((AllocBitmap*) Block)->Count;
+	case 5: return ((AllocExtentChunk*) Block)->Count;
+	case 6: return ((AllocBuddy*) Block)->Count;
+	case 7: return ((AllocArena*) Block)->Used > Handle->Padding;
+	default: AssertUnreachable();
 
-		--Handle->Allocators;
 	}
-	else
-	{
-		if(Alloc->Count == Handle->AllocLimit - 1)
-		{
-			if(Handle->Head)
-			{
-				Handle->Head->Prev = Alloc;
-			}
+}
 
-			AssertEQ(Alloc->Prev, NULL);
-			Alloc->Next = (void*) Handle->Head;
-			Handle->Head = (void*) Alloc;
-		}
 
+/* Returns what a block adds to the capacity of its handle.
+ */
+Static alloc_t
+AllocGetBlockLimit(
+	AllocHandleInternal* Handle,
+	AllocBlock* Block
+	)
+{
+	switch(Handle->Engine)
+	{
 
-		(void) memcpy(Ptr, &Alloc->Free, 2);
+	case 3: return ((Alloc4*) Block)->Limit;
+	case 4: return ((AllocBitmap*) Block)->Limit;
+	case 5:
+	case 6:
+	case 7: return Handle->AllocLimit;
+	default: return 0;
 
-		uint8_t* Data = (uint8_t*) Alloc + Handle->Padding;
-		Alloc->Free = ((uintptr_t) Ptr - (uintptr_t) Data) / 2;
 	}
 }
 
 
-Static void*
-AllocAlloc4Func(
+/* Gives back all pages but the first of every free extent that still has
+ * them, until `Retained` drops to `Target`. Returns the number of bytes
+ * released.
+ */
+Static alloc_t
+AllocPurgeExtents(
 	AllocHandleInternal* Handle,
-	alloc_t Size,
-	int Zero
+	alloc_t Retained,
+	alloc_t Target
 	)
 {
-	(void) Size;
+	alloc_t Released = 0;
+	AllocExtentChunk* Chunk = (void*) Handle->Head;
 
-	Alloc4* Alloc = (void*) Handle->Head;
-	if(!Alloc)
+	for(; Chunk && Retained > Target; Chunk = Chunk->Next)
 	{
-		void* RealPtr = AllocAllocVirtualAligned(
-			Handle->BlockSize, Handle->BlockSize, (void**) &Alloc);
-		if(!RealPtr)
-		{
-			return NULL;
-		}
+		uint8_t* Data = AllocGetExtentData(Handle, Chunk);
 
-		Alloc->RealPtr = RealPtr;
-		Alloc->Free = ALLOC4_MAX;
+		for(alloc_t Bin = 0; Bin < ALLOC_EXTENT_BINS; ++Bin)
+		{
+			AllocExtent* Extent = Chunk->Bins[Bin];
 
-		++Handle->Allocators;
-		Handle->Head = (void*) Alloc;
-	}
+			for(; Extent && Retained > Target; Extent = Extent->Next)
+			{
+				alloc_t Page = ((uint8_t*) Extent - Data) >> AllocPageSizeShift;
+				uint32_t Entry = Chunk->Map[Page];
+				alloc_t Pages = Entry & ALLOC_EXTENT_PAGES;
 
-	++Handle->Allocations;
-	++Alloc->Count;
+				if((Entry & ALLOC_EXTENT_PURGED) || Pages == 1)
+				{
+					continue;
+				}
 
-	uint8_t* Data = (uint8_t*) Alloc + Handle->Padding;
+				alloc_t Size = (Pages - 1) << AllocPageSizeShift;
 
-	if(Alloc->Count == Handle->AllocLimit)
-	{
-		Handle->Head = (void*) Alloc->Next;
+				AllocPurgeMemory(Handle, (uint8_t*) Extent + AllocPageSize,
+					Size);
+				AllocMarkExtent(Chunk, Page, Pages,
+					ALLOC_EXTENT_FREE | ALLOC_EXTENT_PURGED);
 
-		if(Alloc->Next)
-		{
-			Alloc->Next->Prev = NULL;
+				Released += Size;
+				Retained -= ALLOC_MIN(Retained, Size);
+			}
 		}
-
-		Alloc->Next = NULL;
 	}
 
-	if(Alloc->Free != ALLOC4_MAX)
-	{
-		void* Ptr = Data + Alloc->Free * Handle->AllocSize;
-
-		(void) memcpy(&Alloc->Free, Ptr, 4);
+	return Released;
+}
 
-		if(Zero)
-		{
-			(void) memset(Ptr, 0, Handle->AllocSize);
-		}
 
-		return Ptr;
-	}
+alloc_t
+AllocHandleTrimH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Target
+	)
+{
+	AllocHandleLockH(Handle);
+		alloc_t Released = AllocHandleTrimUH(Handle, Target);
+	AllocHandleUnlockH(Handle);
 
-	return Data + Alloc->Used++ * Handle->AllocSize;
+	return Released;
 }
 
 
-Static void
-AllocFree4Func(
-	AllocHandleInternal* Handle,
-	void* BlockPtr,
-	void* Ptr,
-	alloc_t Size
+alloc_t
+AllocHandleTrimUH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Target
 	)
 {
-	(void) Size;
+	AllocHandleInternal* HandleInternal = (void*) Handle;
 
-	Alloc4* Alloc = BlockPtr;
+	if(AllocHandleIsVirtual(HandleInternal))
+	{
+		return 0;
+	}
 
-	--Handle->Allocations;
-	--Alloc->Count;
+	alloc_t Released = 0;
+	AllocBlock* Block;
 
-	if(
-		Alloc->Count == 0 &&
-		(
-			(Handle->Flags & ALLOC_HANDLE_FLAG_IMMEDIATE_FREE) ||
-			(
-				Handle->Allocators >= 2 &&
-				!(Handle->Flags & ALLOC_HANDLE_FLAG_DO_NOT_FREE) &&
-				Handle->Allocations <=
-					Handle->AllocLimit * (Handle->Allocators - 2)
-			)
-		)
-		)
+	/* Blocks of stacks can have marks pointing into them even when empty, so
+	 * only the ones they keep for reuse are freed.
+	 */
+	if(HandleInternal->Engine == 8)
 	{
-		if(Alloc->Prev)
-		{
-			Alloc->Prev->Next = Alloc->Next;
-		}
-		else
+		while(HandleInternal->Full && HandleInternal->Footprint > Target)
 		{
-			Handle->Head = (void*) Alloc->Next;
-		}
+			Block = HandleInternal->Full;
 
-		if(Alloc->Next)
-		{
-			Alloc->Next->Prev = Alloc->Prev;
-		}
+			AllocUnlinkBlock(&HandleInternal->Full, Block);
+			HandleInternal->Capacity -= HandleInternal->AllocLimit;
 
-		AllocFreeVirtualAligned(Alloc->RealPtr,
-			Handle->BlockSize, Handle->BlockSize);
+			Released += AllocFreeBlock(HandleInternal, Block);
+			--HandleInternal->Allocators;
+		}
 
-		--Handle->Allocators;
+		return Released;
 	}
-	else
+
+	AllocBlock** Lists[ALLOC_FREE_LISTS];
+	alloc_t ListCount = AllocGetFreeLists(HandleInternal, Lists);
+
+	/* Empty blocks first, since freeing them actually shrinks the footprint.
+	 */
+	for(alloc_t i = 0; i < ListCount; ++i)
 	{
-		if(Alloc->Count == Handle->AllocLimit - 1)
+		Block = *Lists[i];
+
+		while(Block && HandleInternal->Footprint > Target)
 		{
-			if(Handle->Head)
+			AllocBlock* Next = Block->Next;
+
+			if(!AllocGetBlockCount(HandleInternal, Block))
 			{
-				Handle->Head->Prev = Alloc;
+				AllocUnlinkBlock(Lists[i], Block);
+
+				HandleInternal->Capacity -=
+					AllocGetBlockLimit(HandleInternal, Block);
+
+				Released += AllocFreeBlock(HandleInternal, Block);
+				--HandleInternal->Allocators;
 			}
 
-			AssertEQ(Alloc->Prev, NULL);
-			Alloc->Next = (void*) Handle->Head;
-			Handle->Head = (void*) Alloc;
+			Block = Next;
 		}
+	}
 
+	if(AllocHandleIsDirty(HandleInternal))
+	{
+		return Released;
+	}
 
-		(void) memcpy(Ptr, &Alloc->Free, 4);
+	/* Then the pages of big free objects, which are not counted by
+	 * the footprint, but are released all the same.
+	 */
+	alloc_t Retained = HandleInternal->Footprint;
 
-		uint8_t* Data = (uint8_t*) Alloc + Handle->Padding;
-		Alloc->Free = ((uintptr_t) Ptr - (uintptr_t) Data) / Handle->AllocSize;
+	if(HandleInternal->Engine == 5)
+	{
+		return Released +
+			AllocPurgeExtents(HandleInternal, Retained, Target);
 	}
-}
 
+	if(
+		HandleInternal->Engine != 3 ||
+		HandleInternal->AllocSize < ALLOC_PURGE_ZERO_MIN
+		)
+	{
+		return Released;
+	}
 
-Static void*
-AllocAllocVirtualFunc(
-	AllocHandleInternal* Handle,
-	alloc_t Size,
-	int Zero
-	)
-{
-	(void) Handle;
-	(void) Zero;
+	for(alloc_t i = 0; i < ListCount; ++i)
+	{
+		Block = *Lists[i];
 
-	return AllocAllocVirtual(Size);
-}
+		while(Block && Retained > Target)
+		{
+			Alloc4* Alloc = (void*) Block;
+			uint8_t* Data = AllocGetBlockData(HandleInternal, Alloc);
+			uint32_t Free = Alloc->Free;
 
+			while(Free != ALLOC4_MAX && Retained > Target)
+			{
+				uint8_t* Ptr = Data + Free * HandleInternal->AllocSize;
 
-Static void
-AllocFreeVirtualFunc(
-	AllocHandleInternal* Handle,
-	void* BlockPtr,
-	void* Ptr,
-	alloc_t Size
-	)
-{
-	(void) Handle;
+				if(!Ptr[4])
+				{
+					AllocPurgeObject4(HandleInternal, Ptr);
+					Released += HandleInternal->AllocSize;
+					Retained -= ALLOC_MIN(Retained, HandleInternal->AllocSize);
+				}
 
-	AssertEQ(BlockPtr, Ptr);
+				(void) memcpy(&Free, Ptr, 4);
+			}
 
-	AllocFreeVirtual(Ptr, Size);
+			Block = Block->Next;
+		}
+	}
+
+	return Released;
 }
 
 
-Static int
-AllocHandleIsVirtual(
-	_in_ AllocHandleInternal* Handle
+void
+AllocHandleResetH(
+	_opaque_ AllocHandle* Handle
 	)
 {
-	return !Handle->BlockSize;
+	AllocHandleLockH(Handle);
+		AllocHandleResetUH(Handle);
+	AllocHandleUnlockH(Handle);
 }
 
 
 void
-AllocCreateHandle(
-	_in_ AllocHandleInfo* Info,
+AllocHandleResetUH(
 	_opaque_ AllocHandle* Handle
 	)
 {
 	AllocHandleInternal* HandleInternal = (void*) Handle;
 
-#if ALLOC_THREADS == 1
-	AllocMutexInit(&HandleInternal->Mutex);
-#endif
-
-	HandleInternal->Allocators = 0;
-	HandleInternal->Allocations = 0;
-
-	HandleInternal->Head = NULL;
-
-	HandleInternal->Flags = ALLOC_HANDLE_FLAG_NONE;
-
+	AllocResetVirtual(HandleInternal);
 
-	if(!Info)
+	if(AllocHandleIsVirtual(HandleInternal))
 	{
-		HandleInternal->Padding = 0;
-		HandleInternal->AllocLimit = 0;
-		HandleInternal->AllocSize = 0;
-		HandleInternal->BlockSize = 0;
-
-		HandleInternal->AllocFunc = AllocAllocVirtualFunc;
-		HandleInternal->FreeFunc = AllocFreeVirtualFunc;
-
 		return;
 	}
 
+	AllocBlock** Lists[ALLOC_FREE_LISTS + 1];
+	alloc_t ListCount = AllocGetFreeLists(HandleInternal, Lists);
+	Lists[ListCount++] = &HandleInternal->Full;
 
-	AssertNEQ(Info->Alignment, 0);
-	AssertEQ(ALLOC_IS_POWER_OF_2(Info->Alignment), 1);
-
-
-	static const alloc_t BlockSizeMax[] =
-	(const alloc_t[])
+	for(alloc_t i = 0; i < ListCount; ++i)
 	{
-		0,
-		65536,
-		131072,
-		1073741824
-	};
+		AllocBlock* Block = *Lists[i];
 
-	static const alloc_t AllocLimitMax[] =
-	(const alloc_t[])
-	{
-		0,
-		UINT8_MAX - 2,
-		UINT16_MAX - 2,
-		UINT32_MAX - 2
-	};
+		while(Block)
+		{
+			AllocBlock* Next = Block->Next;
+			(void) AllocFreeBlock(HandleInternal, Block);
+			Block = Next;
+		}
+	}
+
+	HandleInternal->Head = NULL;
+	HandleInternal->Full = NULL;
 
-	static const AllocAllocFunc AllocFuncs[] =
-	(const AllocAllocFunc[])
+	for(alloc_t i = 0; i < ALLOC_BUCKETS; ++i)
 	{
-		NULL,
-		AllocAlloc1Func,
-		AllocAlloc2Func,
-		AllocAlloc4Func
-	};
+		HandleInternal->Buckets[i] = NULL;
+	}
 
-	static const AllocFreeFunc FreeFuncs[] =
-	(const AllocFreeFunc[])
+	if(HandleInternal->Levels)
 	{
-		NULL,
-		AllocFree1Func,
-		AllocFree2Func,
-		AllocFree4Func
-	};
+		AllocReleaseVirtual(HandleInternal, HandleInternal->Levels,
+			ALLOC_BUDDY_LEVELS * sizeof(AllocBlock*));
 
-	alloc_t TableIndex = ALLOC_MIN(Info->AllocSize, 3U);
+		HandleInternal->Levels = NULL;
+	}
 
+	HandleInternal->Allocators = 0;
+	HandleInternal->Allocations = 0;
+	HandleInternal->Capacity = 0;
+}
 
-	if(Info->AllocSize == 1)
-	{
-		alloc_t BlockSize = Info->BlockSize;
-		BlockSize = ALLOC_MIN(BlockSize, BlockSizeMax[TableIndex]);
-		BlockSize = ALLOC_MAX(BlockSize, AllocPageSize);
-		BlockSize = AllocGetNextPO2(BlockSize);
 
-		alloc_t AllocLimit =
-			(BlockSize - sizeof(Alloc1Block)) / sizeof(Alloc1);
-		AllocLimit = ALLOC_MIN(AllocLimit, AllocLimitMax[TableIndex]);
-		AllocLimit = ALLOC_MAX(AllocLimit, 1U);
+void
+AllocArenaResetH(
+	_opaque_ AllocHandle* Handle
+	)
+{
+	AllocHandleLockH(Handle);
+		AllocArenaResetUH(Handle);
+	AllocHandleUnlockH(Handle);
+}
 
-		BlockSize = sizeof(Alloc1Block) + AllocLimit * sizeof(Alloc1);
-		BlockSize = AllocGetNextPO2(BlockSize);
 
-		HandleInternal->Padding = 0;
-		HandleInternal->AllocLimit = AllocLimit;
-		HandleInternal->AllocSize = 1;
-		HandleInternal->BlockSize = BlockSize;
+void
+AllocArenaResetUH(
+	_opaque_ AllocHandle* Handle
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
 
-		HandleInternal->AllocFunc = AllocFuncs[TableIndex];
-		HandleInternal->FreeFunc = FreeFuncs[TableIndex];
+	AssertEQ(HandleInternal->Engine, 7);
 
+	AllocArena* Block = (void*) HandleInternal->Head;
+	if(!Block)
+	{
 		return;
 	}
 
+	/* The first block is the last one on the list.
+	 */
+	while(Block->Next)
+	{
+		AllocArena* Next = Block->Next;
 
-	alloc_t AllocSize = Info->AllocSize == 2 ? sizeof(Alloc2) : sizeof(Alloc4);
-
-	alloc_t Mask = Info->Alignment - 1;
-	alloc_t Padding = (AllocSize + Mask) & ~Mask;
+		AllocUnlinkBlock(&HandleInternal->Head, Block);
+		HandleInternal->Capacity -= HandleInternal->AllocLimit;
 
-	alloc_t BlockSize = Info->BlockSize;
-	BlockSize = ALLOC_MIN(BlockSize, BlockSizeMax[TableIndex]);
-	BlockSize = ALLOC_MAX(BlockSize, AllocPageSize);
-	BlockSize = AllocGetNextPO2(BlockSize);
+		(void) AllocFreeBlock(HandleInternal, (void*) Block);
+		--HandleInternal->Allocators;
 
-	alloc_t AllocLimit = (BlockSize - AllocSize) / Info->AllocSize;
-	AllocLimit = ALLOC_MIN(AllocLimit, AllocLimitMax[TableIndex]);
-	AllocLimit = ALLOC_MAX(AllocLimit, 1U);
+		Block = Next;
+	}
 
-	BlockSize = Padding + AllocLimit * Info->AllocSize;
-	BlockSize = AllocGetNextPO2(BlockSize);
+	Block->Used = HandleInternal->Padding;
+	HandleInternal->Allocations = 0;
+}
 
-	HandleInternal->Padding = Padding;
-	HandleInternal->AllocLimit = AllocLimit;
-	HandleInternal->AllocSize = Info->AllocSize;
-	HandleInternal->BlockSize = Info->BlockSize;
 
-	HandleInternal->AllocFunc = AllocFuncs[TableIndex];
-	HandleInternal->FreeFunc = FreeFuncs[TableIndex];
+void
+AllocArenaReleaseH(
+	_opaque_ AllocHandle* Handle
+	)
+{
+	AllocHandleLockH(Handle);
+		AllocArenaReleaseUH(Handle);
+	AllocHandleUnlockH(Handle);
 }
 
 
 void
-AllocCloneHandle(
-	_opaque_ AllocHandle* Source,
+AllocArenaReleaseUH(
 	_opaque_ AllocHandle* Handle
 	)
 {
-	AllocHandleInternal* SourceInternal = (void*) Source;
+	AllocHandleInternal* HandleInternal = (void*) Handle;
 
-	AllocHandleInfo Info =
-	{
-		.AllocSize = SourceInternal->AllocSize,
-		.BlockSize = SourceInternal->BlockSize,
-		/* Not quite right, but not wrong either. */
-		.Alignment = SourceInternal->Padding
-	};
+	AssertEQ(HandleInternal->Engine, 7);
 
-	AllocCreateHandle(&Info, Handle);
+	AllocHandleResetUH(Handle);
 }
 
 
-void
-AllocDestroyHandle(
+alloc_t
+AllocStackMarkH(
+	_opaque_ AllocHandle* Handle
+	)
+{
+	alloc_t Mark;
+
+	AllocHandleLockH(Handle);
+		Mark = AllocStackMarkUH(Handle);
+	AllocHandleUnlockH(Handle);
+
+	return Mark;
+}
+
+
+/* The address of the first free byte of the newest block that has anything
+ * in it, so that the mark never points into a block set aside when emptied.
+ * `Used` is never `0`, so the byte before it is always in the same block.
+ */
+_pure_func_ alloc_t
+AllocStackMarkUH(
 	_opaque_ AllocHandle* Handle
 	)
 {
 	AllocHandleInternal* HandleInternal = (void*) Handle;
 
-	if(HandleInternal->Head)
+	AssertEQ(HandleInternal->Engine, 8);
+
+	AllocArena* Block = (void*) HandleInternal->Head;
+
+	if(Block && Block->Used == HandleInternal->Padding)
 	{
-		AllocFreeVirtualAligned(HandleInternal->Head->RealPtr,
-			HandleInternal->BlockSize, HandleInternal->BlockSize);
+		Block = Block->Next;
 	}
 
-#if ALLOC_THREADS == 1
-	AllocMutexDestroy(&HandleInternal->Mutex);
-#endif
+	if(!Block)
+	{
+		return 0;
+	}
+
+	return (uintptr_t) Block + Block->Used;
 }
 
 
-Static uint32_t
-AllocDefaultIndexFunc(
-	alloc_t Size
+void
+AllocStackRestoreH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Mark
 	)
 {
-	return AllocLog2(AllocGetNextPO2(Size));
+	AllocHandleLockH(Handle);
+		AllocStackRestoreUH(Handle, Mark);
+	AllocHandleUnlockH(Handle);
 }
 
 
-_alloc_func_ const AllocState*
-AllocAllocState(
-	_in_ AllocStateInfo* Info
+void
+AllocStackRestoreUH(
+	_opaque_ AllocHandle* Handle,
+	alloc_t Mark
 	)
 {
-	if(!Info)
-	{
-		Info = &AllocDefaultStateInfo;
-	}
+	AllocHandleInternal* HandleInternal = (void*) Handle;
 
+	AssertEQ(HandleInternal->Engine, 8);
 
-	alloc_t HandleCount = Info->HandleCount + 1;
-	AllocState* State = AllocAllocVirtual(
-		sizeof(AllocState) + sizeof(AllocHandle) * HandleCount);
-	if(!State)
+	AllocArena* Block = NULL;
+
+	if(Mark)
 	{
-		return NULL;
+		Block = AllocGetBlockHeader(HandleInternal,
+			AllocGetBlockBase(HandleInternal, (void*) (Mark - 1)));
 	}
 
-	if(!Info->IndexFunc)
+	while((void*) HandleInternal->Head != Block)
 	{
-		State->IndexFunc = AllocDefaultIndexFunc;
+		AllocArena* Top = (void*) HandleInternal->Head;
+		AssertNEQ(Top, NULL);
+
+		HandleInternal->Allocations -= Top->Used - HandleInternal->Padding;
+		AllocUnlinkBlock(&HandleInternal->Head, Top);
+
+		if(HandleInternal->Flags & ALLOC_HANDLE_FLAG_IMMEDIATE_FREE)
+		{
+			HandleInternal->Capacity -= HandleInternal->AllocLimit;
+
+			(void) AllocFreeBlock(HandleInternal, (void*) Top);
+			--HandleInternal->Allocators;
+		}
+		else
+		{
+			AllocPushBlock(&HandleInternal->Full, Top);
+		}
 	}
-	else
+
+	/* Objects freed since the mark can have already moved `Used` below it.
+	 */
+	if(Block)
 	{
-		State->IndexFunc = Info->IndexFunc;
+		alloc_t Used = Mark - (uintptr_t) Block;
+
+		if(Used < Block->Used)
+		{
+			HandleInternal->Allocations -= Block->Used - Used;
+			Block->Used = Used;
+		}
 	}
+}
 
-	State->HandleCount = HandleCount;
+
+void
+AllocHandleWalkH(
+	_opaque_ AllocHandle* Handle,
+	AllocWalkFunc Func,
+	void* Context
+	)
+{
+	AllocHandleLockH(Handle);
+		AllocHandleWalkUH(Handle, Func, Context);
+	AllocHandleUnlockH(Handle);
+}
 
 
-	AllocHandleInfo* HandleInfo = Info->Handles;
-	AllocHandleInfo* HandleInfoEnd = HandleInfo + Info->HandleCount;
+void
+AllocHandleWalkUH(
+	_opaque_ AllocHandle* Handle,
+	AllocWalkFunc Func,
+	void* Context
+	)
+{
+	AllocHandleInternal* HandleInternal = (void*) Handle;
 
-	alloc_t i = 0;
+	AssertEQ(HandleInternal->Engine, 4);
 
-	for(; HandleInfo < HandleInfoEnd; ++HandleInfo, ++i)
+	AllocBlock** Lists[ALLOC_FREE_LISTS + 1];
+	alloc_t ListCount = AllocGetFreeLists(HandleInternal, Lists);
+	Lists[ListCount++] = &HandleInternal->Full;
+
+	for(alloc_t i = 0; i < ListCount; ++i)
 	{
-		AllocCreateHandle(HandleInfo, &State->Handles[i]);
-	}
+		for(AllocBlock* Block = *Lists[i]; Block; Block = Block->Next)
+		{
+			AllocBitmap* Alloc = (void*) Block;
+			uint8_t* Data = AllocGetBlockData(HandleInternal, Alloc);
 
-	AllocCreateHandle(NULL, &State->Handles[i]);
+			/* Nothing past `Used` was ever handed out.
+			 */
+			alloc_t Words = (Alloc->Used + 63) / 64;
 
+			for(alloc_t Word = 0; Word < Words; ++Word)
+			{
+				uint64_t Bits = Alloc->Bits[Word];
 
-	return State;
+				while(Bits)
+				{
+					alloc_t Index = Word * 64 + __builtin_ctzll(Bits);
+					Bits &= Bits - 1;
+
+					Func(Data + Index * HandleInternal->AllocSize, Context);
+				}
+			}
+		}
+	}
 }
 
 
-_alloc_func_ const AllocState*
-AllocCloneState(
-	_in_ AllocState* Source
+void
+AllocResetState(
+	_in_opt_ AllocState* State
 	)
 {
-	alloc_t HandleCount = Source->HandleCount;
-	alloc_t TotalSize = sizeof(AllocState) + sizeof(AllocHandle) * HandleCount;
-
-	AllocState* State = AllocAllocVirtual(TotalSize);
 	if(!State)
 	{
-		return NULL;
+		State = AllocGlobalState;
 	}
 
-	(void) memcpy(State, Source, TotalSize);
-
-	for(alloc_t i = 0; i < HandleCount; ++i)
+	for(alloc_t i = 0; i < State->HandleCount; ++i)
 	{
-		AllocHandleInternal* Handle = (void*) &Source->Handles[i];
-
-		Handle->Allocators = 0;
-		Handle->Allocations = 0;
-
-		Handle->Flags = 0;
-
-		Handle->Head = NULL;
+		AllocHandleResetH(&State->Handles[i]);
 	}
-
-	return State;
 }
 
 
-void
-AllocFreeState(
-	_opaque_ AllocState* State
+alloc_t
+AllocTrimState(
+	_in_opt_ AllocState* State,
+	alloc_t Target
 	)
 {
 	if(!State)
@@ -1508,351 +5882,495 @@ AllocFreeState(
 		State = AllocGlobalState;
 	}
 
+	alloc_t Footprint = 0;
 
-	alloc_t i = 0;
-	alloc_t HandleCount = State->HandleCount;
+	for(alloc_t i = 0; i < State->HandleCount; ++i)
+	{
+		AllocHandleInternal* HandleInternal = (void*) &State->Handles[i];
+		Footprint += __atomic_load_n(&HandleInternal->Footprint,
+			__ATOMIC_RELAXED);
+	}
 
-	for(; i < HandleCount; ++i)
+	alloc_t Released = 0;
+
+	/* Handles of bigger objects have bigger blocks, so fewer of them have to
+	 * be visited.
+	 */
+	for(alloc_t i = State->HandleCount; i-- > 0 && Footprint > Target;)
 	{
-		AllocDestroyHandle(&State->Handles[i]);
+		const AllocHandle* Handle = &State->Handles[i];
+		AllocHandleInternal* HandleInternal = (void*) Handle;
+
+		AllocHandleLockH(Handle);
+			alloc_t Current = HandleInternal->Footprint;
+			alloc_t Excess = ALLOC_MIN(Current, Footprint - Target);
+			alloc_t HandleReleased =
+				AllocHandleTrimUH(Handle, Current - Excess);
+			alloc_t Shrunk = Current - HandleInternal->Footprint;
+		AllocHandleUnlockH(Handle);
+
+		/* Blocks of dirty regions shrink the footprint without releasing
+		 * anything, and purged objects the other way around.
+		 */
+		Released += HandleReleased;
+		Footprint -= ALLOC_MIN(Footprint, ALLOC_MAX(Shrunk, HandleReleased));
 	}
 
-	AllocFreeVirtual(State, sizeof(AllocState) +
-		HandleCount * sizeof(AllocHandleInternal));
+	return Released;
 }
 
 
-_pure_func_ _opaque_ AllocHandle*
-AllocGetHandleS(
-	_in_ AllocState* State,
-	alloc_t Size
-	)
-{
-	if(Size == 0)
+#if ALLOC_THREADS == 1 && !defined(_WIN32)
+	#include <fcntl.h>
+	#include <time.h>
+
+
+	#ifndef ALLOC_RECLAIM_MAX_STATES
+		#define ALLOC_RECLAIM_MAX_STATES 64
+	#endif
+
+	Static pthread_mutex_t AllocReclaimMutex = PTHREAD_MUTEX_INITIALIZER;
+	Static pthread_cond_t AllocReclaimCond = PTHREAD_COND_INITIALIZER;
+	Static pthread_t AllocReclaimThread;
+	Static int AllocReclaimRunning;
+
+	/* Set while the agent goes through its copy of the registered states,
+	 * with `AllocReclaimMutex` unlocked. `AllocUnregisterState` waits on
+	 * `AllocReclaimIdleCond` for it to clear, so that states are never
+	 * touched after they were unregistered.
+	 */
+	Static int AllocReclaimBusy;
+	Static pthread_cond_t AllocReclaimIdleCond = PTHREAD_COND_INITIALIZER;
+	Static AllocReclaimInfo AllocReclaimConfig;
+
+	/* The spare count currently applied to the registered states.
+	 */
+	Static alloc_t AllocReclaimSpare = ALLOC_DEFAULT_SPARE;
+
+	Static const AllocState* AllocReclaimStates[ALLOC_RECLAIM_MAX_STATES];
+	Static alloc_t AllocReclaimStateCount;
+
+
+	/* Whether the registered states are under pressure.
+	 */
+	Static int AllocReclaimPressure;
+
+
+	/* Handles with a spare count of their own always keep it.
+	 */
+	Static void
+	AllocReclaimApplySpare(
+		const AllocState* State,
+		alloc_t Spare
+		)
 	{
-		/* No functions use a handle when size is 0 */
-		return NULL;
+		for(alloc_t i = 0; i < State->HandleCount; ++i)
+		{
+			AllocHandleInternal* HandleInternal = (void*) &State->Handles[i];
+
+			AllocHandleLockH(&State->Handles[i]);
+
+			if(!HandleInternal->Info.Spare)
+			{
+				HandleInternal->Spare = Spare;
+			}
+
+			AllocHandleUnlockH(&State->Handles[i]);
+		}
+	}
+
+
+	/* Parses the decimal number at `*Str` and moves past it. With `Scale`,
+	 * the number is multiplied by 100 and keeps up to 2 decimal places.
+	 */
+	Static uint64_t
+	AllocReclaimParseNumber(
+		_inout_ const char** Str,
+		int Scale
+		)
+	{
+		const char* Ptr = *Str;
+		uint64_t Value = 0;
+
+		while(*Ptr >= '0' && *Ptr <= '9')
+		{
+			Value = Value * 10 + (*Ptr++ - '0');
+		}
+
+		if(Scale)
+		{
+			Value *= 100;
+
+			if(*Ptr == '.')
+			{
+				++Ptr;
+
+				for(uint64_t Digit = 10; Digit; Digit /= 10)
+				{
+					if(*Ptr < '0' || *Ptr > '9')
+					{
+						break;
+					}
+
+					Value += (*Ptr++ - '0') * Digit;
+				}
+
+				while(*Ptr >= '0' && *Ptr <= '9')
+				{
+					++Ptr;
+				}
+			}
+		}
+
+		*Str = Ptr;
+
+		return Value;
 	}
 
-	uint32_t Index = State->IndexFunc(Size);
-	Index = ALLOC_MIN(Index, State->HandleCount - 1);
 
-	return &State->Handles[Index];
-}
+	/* Reads the pressure file. PSI files report pressure through `avg10`,
+	 * and `memory.events` through the `high` and `max` counters, which only
+	 * matter when they grow. Returns `-1` if the file cannot be read.
+	 *
+	 * The file is read with plain system calls, so that the agent does not
+	 * pull in buffered I/O or locale dependent parsing.
+	 */
+	Static int
+	AllocReclaimReadPressure(
+		_inout_ uint64_t* Events
+		)
+	{
+		int Fd = open(AllocReclaimConfig.Path, O_RDONLY | O_CLOEXEC);
+		if(Fd < 0)
+		{
+			return -1;
+		}
+
+		char Buffer[1024];
+		alloc_t Length = 0;
+
+		while(Length < sizeof(Buffer) - 1)
+		{
+			ssize_t Count = read(Fd, Buffer + Length,
+				sizeof(Buffer) - 1 - Length);
+			if(Count <= 0)
+			{
+				break;
+			}
+
+			Length += Count;
+		}
+
+		(void) close(Fd);
+
+		Buffer[Length] = 0;
+
+		int Pressure = 0;
+		uint64_t NewEvents = 0;
+		const char* Line = Buffer;
+
+		while(*Line)
+		{
+			if(!strncmp(Line, "some avg10=", 11))
+			{
+				Line += 11;
+				Pressure |= AllocReclaimParseNumber(&Line, 1) >=
+					AllocReclaimConfig.Threshold;
+			}
+			else if(!strncmp(Line, "high ", 5))
+			{
+				Line += 5;
+				NewEvents += AllocReclaimParseNumber(&Line, 0);
+			}
+			else if(!strncmp(Line, "max ", 4))
+			{
+				Line += 4;
+				NewEvents += AllocReclaimParseNumber(&Line, 0);
+			}
+
+			while(*Line && *Line != '\n')
+			{
+				++Line;
+			}
+
+			if(*Line)
+			{
+				++Line;
+			}
+		}
+
+		Pressure |= NewEvents > *Events;
+		*Events = NewEvents;
+
+		return Pressure;
+	}
 
 
-void
-AllocHandleLockH(
-	_opaque_ AllocHandle* Handle
-	)
-{
-	AllocHandleInternal* HandleInternal = (void*) Handle;
+	Static void*
+	AllocReclaimThreadFunc(
+		void* Arg
+		)
+	{
+		(void) Arg;
 
-	ALLOC_LOCK(&HandleInternal->Mutex);
-}
+		uint64_t Events = 0;
+		(void) AllocReclaimReadPressure(&Events);
 
+		pthread_mutex_lock(&AllocReclaimMutex);
 
-void
-AllocHandleUnlockH(
-	_opaque_ AllocHandle* Handle
-	)
-{
-	AllocHandleInternal* HandleInternal = (void*) Handle;
+		while(AllocReclaimRunning)
+		{
+			struct timespec Deadline;
+			clock_gettime(CLOCK_REALTIME, &Deadline);
 
-	ALLOC_UNLOCK(&HandleInternal->Mutex);
-}
+			uint64_t Nanoseconds = Deadline.tv_nsec +
+				(uint64_t) AllocReclaimConfig.Interval * 1000000;
+			Deadline.tv_sec += Nanoseconds / 1000000000;
+			Deadline.tv_nsec = Nanoseconds % 1000000000;
 
+			(void) pthread_cond_timedwait(&AllocReclaimCond,
+				&AllocReclaimMutex, &Deadline);
 
-void
-AllocHandleSetFlagsH(
-	_opaque_ AllocHandle* Handle,
-	AllocHandleFlag Flags
-	)
-{
-	AllocHandleLockH(Handle);
-		AllocHandleSetFlagsUH(Handle, Flags);
-	AllocHandleUnlockH(Handle);
-}
+			if(!AllocReclaimRunning)
+			{
+				break;
+			}
 
+			pthread_mutex_unlock(&AllocReclaimMutex);
 
-void
-AllocHandleSetFlagsUH(
-	_opaque_ AllocHandle* Handle,
-	AllocHandleFlag Flags
-	)
-{
-	AllocHandleInternal* HandleInternal = (void*) Handle;
+			int Pressure = AllocReclaimReadPressure(&Events);
 
-	HandleInternal->Flags = Flags;
-}
+			pthread_mutex_lock(&AllocReclaimMutex);
 
+			if(Pressure < 0)
+			{
+				continue;
+			}
 
-void
-AllocHandleAddFlagsH(
-	_opaque_ AllocHandle* Handle,
-	AllocHandleFlag Flags
-	)
-{
-	AllocHandleLockH(Handle);
-		AllocHandleAddFlagsUH(Handle, Flags);
-	AllocHandleUnlockH(Handle);
-}
+			alloc_t Spare = Pressure ? 0 : AllocReclaimConfig.Spare;
+			int Changed =
+				Spare != AllocReclaimSpare || Pressure != AllocReclaimPressure;
 
+			/* States registered from now on get the new values right away.
+			 */
+			AllocReclaimSpare = Spare;
+			AllocReclaimPressure = Pressure;
 
-void
-AllocHandleAddFlagsUH(
-	_opaque_ AllocHandle* Handle,
-	AllocHandleFlag Flags
-	)
-{
-	AllocHandleInternal* HandleInternal = (void*) Handle;
+			if(!Changed && !Pressure)
+			{
+				continue;
+			}
 
-	HandleInternal->Flags |= Flags;
-}
+			/* Handles are locked and trimmed with the mutex unlocked, so that
+			 * registering states is not held up by them.
+			 */
+			const AllocState* States[ALLOC_RECLAIM_MAX_STATES];
+			alloc_t StateCount = AllocReclaimStateCount;
 
+			(void) memcpy(States, AllocReclaimStates,
+				sizeof(*States) * StateCount);
 
-void
-AllocHandleDelFlagsH(
-	_opaque_ AllocHandle* Handle,
-	AllocHandleFlag Flags
-	)
-{
-	AllocHandleLockH(Handle);
-		AllocHandleDelFlagsUH(Handle, Flags);
-	AllocHandleUnlockH(Handle);
-}
+			AllocReclaimBusy = 1;
 
+			pthread_mutex_unlock(&AllocReclaimMutex);
 
-void
-AllocHandleDelFlagsUH(
-	_opaque_ AllocHandle* Handle,
-	AllocHandleFlag Flags
-	)
-{
-	AllocHandleInternal* HandleInternal = (void*) Handle;
+			for(alloc_t i = 0; i < StateCount; ++i)
+			{
+				const AllocState* State = States[i];
 
-	HandleInternal->Flags &= ~Flags;
-}
+				if(Changed)
+				{
+					AllocReclaimApplySpare(State, Spare);
+				}
 
+				if(!Pressure)
+				{
+					continue;
+				}
 
-AllocHandleFlag
-AllocHandleGetFlagsH(
-	_opaque_ AllocHandle* Handle
-	)
-{
-	AllocHandleFlag Flags;
+				for(alloc_t j = 0; j < State->HandleCount; ++j)
+				{
+					AllocHandleLockH(&State->Handles[j]);
+						(void) AllocHandleTrimUH(
+							&State->Handles[j], 0);
+					AllocHandleUnlockH(&State->Handles[j]);
+				}
+			}
 
-	AllocHandleLockH(Handle);
-		Flags = AllocHandleGetFlagsUH(Handle);
-	AllocHandleUnlockH(Handle);
+			pthread_mutex_lock(&AllocReclaimMutex);
 
-	return Flags;
-}
+			AllocReclaimBusy = 0;
+			pthread_cond_broadcast(&AllocReclaimIdleCond);
+		}
 
+		pthread_mutex_unlock(&AllocReclaimMutex);
 
-AllocHandleFlag
-AllocHandleGetFlagsUH(
-	_opaque_ AllocHandle* Handle
-	)
-{
-	AllocHandleInternal* HandleInternal = (void*) Handle;
+		return NULL;
+	}
 
-	return HandleInternal->Flags;
-}
 
+#endif
 
-Static void*
-GetBasePtr(
-	AllocHandleInternal* Handle,
-	_in_ void* Ptr
+
+int
+AllocStartReclaimAgent(
+	_in_opt_ AllocReclaimInfo* Info
 	)
 {
-	if(AllocHandleIsVirtual(Handle))
+#if ALLOC_THREADS == 1 && !defined(_WIN32)
+	pthread_mutex_lock(&AllocReclaimMutex);
+
+	if(AllocReclaimRunning)
 	{
-		return (void*) Ptr;
+		pthread_mutex_unlock(&AllocReclaimMutex);
+		return 0;
 	}
 
-	void* BlockPtr = (void*)
-		((uintptr_t) Ptr & ~(Handle->BlockSize - 1));
-
-	return BlockPtr;
-}
-
+	AllocReclaimConfig = Info ? *Info : (AllocReclaimInfo){0};
 
-_alloc_func_ void*
-AllocAllocH(
-	_opaque_ AllocHandle* Handle,
-	alloc_t Size,
-	int Zero
-	)
-{
-	if(!Size)
+	if(!AllocReclaimConfig.Path)
 	{
-		return NULL;
+		AllocReclaimConfig.Path = "/proc/pressure/memory";
 	}
 
-	void* Ptr;
+	if(!AllocReclaimConfig.Interval)
+	{
+		AllocReclaimConfig.Interval = 1000;
+	}
 
-	AllocHandleLockH(Handle);
-		Ptr = AllocAllocUH(Handle, Size, Zero);
-	AllocHandleUnlockH(Handle);
+	if(!AllocReclaimConfig.Threshold)
+	{
+		AllocReclaimConfig.Threshold = 1000;
+	}
 
-	return Ptr;
-}
+	AllocReclaimConfig.Spare = AllocReclaimConfig.Spare ?
+		AllocResolveSpare(AllocReclaimConfig.Spare) : 3;
 
+	AllocReclaimRunning = 1;
 
-_alloc_func_ void*
-AllocAllocUH(
-	_opaque_ AllocHandle* Handle,
-	alloc_t Size,
-	int Zero
-	)
-{
-	if(!Size)
+	if(pthread_create(&AllocReclaimThread, NULL, AllocReclaimThreadFunc, NULL))
 	{
-		return NULL;
+		AllocReclaimRunning = 0;
+		pthread_mutex_unlock(&AllocReclaimMutex);
+		return 0;
 	}
 
-	AllocHandleInternal* HandleInternal = (void*) Handle;
+	pthread_mutex_unlock(&AllocReclaimMutex);
+	return 1;
+#else
+	(void) Info;
 
-	return HandleInternal->AllocFunc(HandleInternal, Size, Zero);
+	return 0;
+#endif
 }
 
 
 void
-AllocFreeH(
-	_opaque_ AllocHandle* Handle,
-	_opaque_ void* Ptr,
-	alloc_t Size
+AllocStopReclaimAgent(
+	void
 	)
 {
-	if(!Size)
+#if ALLOC_THREADS == 1 && !defined(_WIN32)
+	pthread_mutex_lock(&AllocReclaimMutex);
+
+	if(!AllocReclaimRunning)
 	{
+		pthread_mutex_unlock(&AllocReclaimMutex);
 		return;
 	}
 
-	AllocHandleLockH(Handle);
-		AllocFreeUH(Handle, Ptr, Size);
-	AllocHandleUnlockH(Handle);
-}
+	AllocReclaimRunning = 0;
+	pthread_cond_signal(&AllocReclaimCond);
 
+	pthread_mutex_unlock(&AllocReclaimMutex);
 
-void
-AllocFreeUH(
-	_opaque_ AllocHandle* Handle,
-	_opaque_ void* Ptr,
-	alloc_t Size
-	)
-{
-	if(!Size)
+	int Status = pthread_join(AllocReclaimThread, NULL);
+	AssertEQ(Status, 0);
+
+	/* Back to the default policy.
+	 */
+	pthread_mutex_lock(&AllocReclaimMutex);
+
+	for(alloc_t i = 0; i < AllocReclaimStateCount; ++i)
 	{
-		return;
+		AllocReclaimApplySpare(AllocReclaimStates[i], ALLOC_DEFAULT_SPARE);
 	}
 
-	AllocHandleInternal* HandleInternal = (void*) Handle;
+	AllocReclaimSpare = ALLOC_DEFAULT_SPARE;
+	AllocReclaimPressure = 0;
 
-	HandleInternal->FreeFunc(HandleInternal,
-		GetBasePtr(HandleInternal, Ptr), (void*) Ptr, Size);
+	pthread_mutex_unlock(&AllocReclaimMutex);
+#endif
 }
 
 
-void*
-AllocReallocH(
-	_opaque_ AllocHandle* OldHandle,
-	_opaque_ void* Ptr,
-	alloc_t OldSize,
-	_opaque_ AllocHandle* NewHandle,
-	alloc_t NewSize,
-	int Zero
+int
+AllocRegisterState(
+	_in_opt_ AllocState* State
 	)
 {
-	if(!NewSize)
-	{
-		AllocFreeH(OldHandle, Ptr, OldSize);
-		return NULL;
-	}
-
-	if(!Ptr)
+#if ALLOC_THREADS == 1 && !defined(_WIN32)
+	if(!State)
 	{
-		return AllocAllocH(NewHandle, NewSize, Zero);
+		State = AllocGlobalState;
 	}
 
-	if(OldHandle == NewHandle)
-	{
-		if(AllocHandleIsVirtual((void*) OldHandle))
-		{
-			return AllocReallocVirtual(Ptr, OldSize, NewSize);
-		}
-
-		if(NewSize > OldSize && Zero)
-		{
-			(void) memset((uint8_t*) Ptr + OldSize, 0, NewSize - OldSize);
-		}
-
-		return (void*) Ptr;
-	}
+	pthread_mutex_lock(&AllocReclaimMutex);
 
-	void* NewPtr = AllocAllocH(NewHandle, NewSize, Zero);
-	if(!NewPtr)
+	if(AllocReclaimStateCount == ALLOC_RECLAIM_MAX_STATES)
 	{
-		return NULL;
+		pthread_mutex_unlock(&AllocReclaimMutex);
+		return 0;
 	}
 
-	(void) memcpy(NewPtr, Ptr, ALLOC_MIN(OldSize, NewSize));
+	AllocReclaimStates[AllocReclaimStateCount++] = State;
+	AllocReclaimApplySpare(State, AllocReclaimSpare);
 
-	AllocFreeH(OldHandle, Ptr, OldSize);
+	pthread_mutex_unlock(&AllocReclaimMutex);
+	return 1;
+#else
+	(void) State;
 
-	return NewPtr;
+	return 0;
+#endif
 }
 
 
-void*
-AllocReallocUH(
-	_opaque_ AllocHandle* OldHandle,
-	_opaque_ void* Ptr,
-	alloc_t OldSize,
-	_opaque_ AllocHandle* NewHandle,
-	alloc_t NewSize,
-	int Zero
+void
+AllocUnregisterState(
+	_in_opt_ AllocState* State
 	)
 {
-	if(!NewSize)
+#if ALLOC_THREADS == 1 && !defined(_WIN32)
+	if(!State)
 	{
-		AllocFreeUH(OldHandle, Ptr, OldSize);
-		return NULL;
+		State = AllocGlobalState;
 	}
 
-	if(!Ptr)
-	{
-		return AllocAllocUH(NewHandle, NewSize, Zero);
-	}
+	pthread_mutex_lock(&AllocReclaimMutex);
 
-	if(OldHandle == NewHandle)
+	for(alloc_t i = 0; i < AllocReclaimStateCount; ++i)
 	{
-		if(AllocHandleIsVirtual((void*) OldHandle))
+		if(AllocReclaimStates[i] == State)
 		{
-			return AllocReallocVirtual(Ptr, OldSize, NewSize);
+			AllocReclaimStates[i] =
+				AllocReclaimStates[--AllocReclaimStateCount];
+			break;
 		}
-
-		if(NewSize > OldSize && Zero)
-		{
-			(void) memset((uint8_t*) Ptr + OldSize, 0, NewSize - OldSize);
-		}
-
-		return (void*) Ptr;
 	}
 
-	void* NewPtr = AllocAllocUH(NewHandle, NewSize, Zero);
-	if(!NewPtr)
+	/* The agent might still be going through a copy of the list that has
+	 * the state in it.
+	 */
+	while(AllocReclaimBusy)
 	{
-		return NULL;
+		pthread_cond_wait(&AllocReclaimIdleCond, &AllocReclaimMutex);
 	}
 
-	(void) memcpy(NewPtr, Ptr, ALLOC_MIN(OldSize, NewSize));
-
-	AllocFreeUH(OldHandle, Ptr, OldSize);
-
-	return NewPtr;
+	pthread_mutex_unlock(&AllocReclaimMutex);
+#else
+	(void) State;
+#endif
 }
 
 